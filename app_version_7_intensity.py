@@ -1,68 +1,126 @@
 import logging
 import json
-from flask import Flask, request, jsonify
-from langchain.chains import LLMChain
-from langchain.prompts import PromptTemplate
-from langchain.output_parsers import StructuredOutputParser, ResponseSchema
+from flask import Flask, Response, request, jsonify
 from typing import Dict, Any
-from groq_client import GroqLLM
-from langchain_community.llms import ollama
 import serial
 import csv
 import io
 import threading
 import time
+import copy
+import socket
+import os
+import struct
+import uuid
+from concurrent.futures import Future
+from contextlib import contextmanager
 from prompt_template import template_5, template_7
+from serial_outbox import SerialOutbox
+from link_monitor import LinkMonitor
+from link_quality import BaudAdapter
+from bulk_transfer import BulkUploader, DEVICE_GROUP_FLAGS, DEVICE_TYPES, encode_device_table
+from frame_pacer import FramePacer
+from local_api import DEFAULT_SOCKET_PATH, DIRECTIONS, LocalApiServer, home_socket_path
+from home_registry import HomeRegistry
+from profiler import PROFILER
+from state_history import StateHistory
+from device_names import AmbiguousDeviceName, DeviceNameResolver
+from singleflight import SingleFlight
+from fast_path import command_key
+from transcript_stream import TranscriptStreams
+from transport import is_local_port, open_transport
 
-class SmartHomeController:
-    def __init__(self, 
-                 serial_port='COM5', 
-                 baud_rate=9600, 
-                 groq_api_key="your groq api key here"):
-        """
-        Initialize Smart Home Controller with serial and Langchain components
-        """
-        # Updated Device State Dictionary
-        self.device_states = {
-            # Lights with ON/OFF and Intensity Control
-            "room 1 light": "off",
-            "room 2 light": {"state": "off", "intensity": 0},  # Intensity control (0-100%)
-            "room 3 light": {"state": "off", "intensity": 0},  # Intensity control (0-100%)
-            "room 4 light": "off",
-            "kitchen light": "off",
-            
-            # TV and Refrigerator (ON/OFF)
-            "TV": "off",
-            "Refrigerator": "off",
+# Firmware buffers 255 bytes between the START and END markers
+MAX_FRAME_PAYLOAD = 240
 
-            # DC Motor (ON/OFF)
-            "DC motor": "off",
+# Re-sends of an unacknowledged batch before the link is left to the heartbeat
+MAX_RESENDS = 3
 
-            # Servo Motor (Clockwise/Anticlockwise in degrees)
-            "Servo motor": {"direction": "none", "degrees": 0}
-        }
+HOMES_CONFIG = "homes.json"
 
-        # Serial Communication Setup
-        try:
-            self.ser = serial.Serial(
-                port=serial_port, 
-                baudrate=baud_rate,
-                bytesize=serial.EIGHTBITS,
-                parity=serial.PARITY_NONE,
-                stopbits=serial.STOPBITS_ONE,
-                timeout=1
-            )
-            print(f"Connected to serial port: {serial_port}")
-            self.ser.close()
-            time.sleep(2)  # Allow microcontroller to reset
-        except serial.SerialException as e:
-            print(f"Error connecting to serial port: {e}")
-            self.ser = None
+# Cold start timeline in seconds since the process started: serial_ready,
+# llm_ready, llm_warm, http_ready, first_command
+BOOT_TIME = time.monotonic()
+STARTUP = {}
+
+def mark_startup(event):
+    """Record and print the first time a startup milestone is reached"""
+    if event not in STARTUP:
+        STARTUP[event] = round(time.monotonic() - BOOT_TIME, 3)
+        print(f"Startup: {event} after {STARTUP[event]} s")
+
+# Order of the compiled-in deviceStates[] in evr_file_V2.c; firmware bulk replies
+# are positional, so controllers replace this with the board's active table
+FIRMWARE_DEVICES = [
+    "room 1 light", "room 2 light", "room 3 light", "room 4 light", "kitchen light",
+    "DC motor", "Servo motor", "Refrigerator", "TV"
+]
+
+# Board reset state of every device
+DEFAULT_DEVICE_STATES = {
+    # Lights with ON/OFF and Intensity Control
+    "room 1 light": "off",
+    "room 2 light": {"state": "off", "intensity": 0},  # Intensity control (0-100%)
+    "room 3 light": {"state": "off", "intensity": 0},  # Intensity control (0-100%)
+    "room 4 light": "off",
+    "kitchen light": "off",
+
+    # TV and Refrigerator (ON/OFF)
+    "TV": "off",
+    "Refrigerator": "off",
+
+    # DC Motor (ON/OFF)
+    "DC motor": "off",
+
+    # Servo Motor (Clockwise/Anticlockwise in degrees)
+    "Servo motor": {"direction": "none", "degrees": 0}
+}
+
+# Firmware device groups (deviceGroups[] in evr_file_V2.c), largest first; an
+# update that sets every member the same way goes out as one group line
+DEVICE_GROUPS = {
+    "all": ["room 1 light", "room 2 light", "room 3 light", "room 4 light", "kitchen light",
+            "DC motor", "Refrigerator", "TV"],
+    "lights": ["room 1 light", "room 2 light", "room 3 light", "room 4 light", "kitchen light"],
+    "loads": ["DC motor", "Refrigerator", "TV"]
+}
+
+# Firmware event log records: tick (u32), type (u8), arg (u8), little endian
+EVENT_RECORD = struct.Struct("<IBB")
+EVENT_TYPES = {1: "frame_received", 2: "line_applied", 3: "unknown_device", 4: "overflow", 5: "uart_error",
+               6: "device_table", 7: "load_on", 8: "load_off"}
+
+class LLMContext:
+    """
+    Groq client, output parser and Langchain chain; built once per process and
+    shared by every home.
+
+    Commands go to the fast cascade model first; its answer is kept only if it
+    parses, names known devices with in-range values and reports at least
+    min_confidence, otherwise the command is re-run on llama-3.3-70b. Devices
+    are checked against the home whose command is running (validating_for), so
+    a home with its own device table is judged by its own names.
+    """
+    def __init__(self, groq_api_key="your groq api key here",
+                 cascade_models=("llama-3.1-8b-instant",),
+                 min_confidence=0.8,
+                 template=template_5):
+        self.min_confidence = min_confidence
+        self.resolver = DeviceNameResolver(FIRMWARE_DEVICES)
+        self._caller = threading.local()
+
+        # Langchain and the Groq SDK are imported only when a context is built
+        from langchain.chains import LLMChain
+        from langchain.prompts import PromptTemplate
+        from langchain.output_parsers import StructuredOutputParser, ResponseSchema
+        from groq_client import GroqLLM
 
         # Initialize Langchain components
         self.llm = GroqLLM(
             groq_api_key=groq_api_key,
-            model_name="llama-3.3-70b-versatile"
+            model_name="llama-3.3-70b-versatile",
+            cascade_models=list(cascade_models),
+            validator=self.validate_output
         )
         
         # Updated response schemas
@@ -90,131 +148,955 @@ class SmartHomeController:
             ResponseSchema(
                 name="delay_seconds", 
                 description="Optional delay (in seconds) before processing the command. Defaults to 0 if not specified."
+            ),
+            ResponseSchema(
+                name="confidence",
+                description="How sure you are that the device states match the command, from 0.0 to 1.0."
             )
         ]
         
         self.output_parser = StructuredOutputParser.from_response_schemas(response_schemas)
         
         # Create prompt template with output parser instructions
-        template = template_5  # Using the new template provided
-        
-        prompt = PromptTemplate(
+        self.prompt = PromptTemplate(
             template=template,
             input_variables=["command"],
             partial_variables={"format_instructions": self.output_parser.get_format_instructions()}
         )
         
         # Create Langchain chain
-        self.chain = LLMChain(llm=self.llm, prompt=prompt)
+        self.chain = LLMChain(llm=self.llm, prompt=self.prompt)
+
+    def warm_up(self):
+        """One tiny completion per model so the first real command finds open connections"""
+        for model in self.llm.cascade_models + [self.llm.model_name]:
+            started = time.monotonic()
+            try:
+                self.llm._complete(model, "Reply with OK.", max_tokens=1)
+                print(f"Warmed up {model} in {(time.monotonic() - started) * 1000:.0f} ms")
+            except Exception as e:
+                logging.error(f"Warm-up call to {model} failed: {e}")
+
+    @contextmanager
+    def validating_for(self, controller):
+        """Check cascade answers made on this thread against controller's devices"""
+        previous = getattr(self._caller, "controller", None)
+        self._caller.controller = controller
+        try:
+            yield
+        finally:
+            self._caller.controller = previous
+
+    def validate_output(self, text):
+        """Check a model answer against the calling home's device manifest before trusting it"""
+        controller = getattr(self._caller, "controller", None)
+        if controller is None:
+            resolver, known_states = self.resolver, DEFAULT_DEVICE_STATES
+        else:
+            resolver, known_states = controller.name_resolver, controller.device_states
+        try:
+            parsed = self.output_parser.parse(text)
+            if float(parsed.get("confidence", 0)) < self.min_confidence:
+                return False
+            device_states = parsed.get("device_states") or {}
+            light_intensity = parsed.get("light_intensity") or {}
+            if not isinstance(device_states, dict) or not isinstance(light_intensity, dict):
+                return False
+            for device, state in device_states.items():
+                if resolver.resolve(device) is None:
+                    return False
+                if isinstance(state, str) and state not in ("on", "off"):
+                    return False
+            for light, intensity in light_intensity.items():
+                if not is_dimmable(known_states.get(resolver.resolve(light))):
+                    return False
+                if not 0 <= int(str(intensity).rstrip('%')) <= 100:
+                    return False
+            angle = parsed.get("servo_motor_angle")
+            if angle is not None and not 0 <= int(str(angle).rstrip('°')) <= 180:
+                return False
+            direction = parsed.get("servo_motor_direction")
+            if direction is not None and direction not in ("clock", "anti", "none"):
+                return False
+            int(parsed.get("delay_seconds", 0))
+        except Exception:
+            return False
+        return True
+
+def start_llm_context(warm_up=True, **kwargs):
+    """
+    Build an LLMContext on a background thread and return a Future of it; the
+    Future resolves as soon as the chain exists, the warm-up call runs after
+    """
+    future = Future()
+
+    def build():
+        try:
+            context = LLMContext(**kwargs)
+        except Exception as e:
+            logging.error(f"LLM initialization failed: {e}")
+            future.set_exception(e)
+            return
+        mark_startup("llm_ready")
+        future.set_result(context)
+        if warm_up:
+            context.warm_up()
+            mark_startup("llm_warm")
+
+    threading.Thread(target=build, daemon=True).start()
+    return future
+
+class InvalidStatePatch(ValueError):
+    def __init__(self, errors):
+        super().__init__("; ".join(errors))
+        self.errors = errors
+
+def merge_device_state(current, patch):
+    """
+    RFC 7396 merge of one device's patch into its current state, validated
+    against the shape of that state; raises ValueError if the result is not a
+    valid state for the device
+    """
+    if patch is None:
+        raise ValueError("devices cannot be removed")
+    if isinstance(current, dict) and "intensity" in current:
+        # "on"/"off" is shorthand for switching a dimmable light at its current intensity
+        if isinstance(patch, str):
+            patch = {"state": patch}
+        if not isinstance(patch, dict):
+            raise ValueError("expected an object with state and/or intensity")
+        merged = dict(current)
+        for key, value in patch.items():
+            if key not in current or value is None:
+                raise ValueError(f"cannot set or remove '{key}'")
+            merged[key] = value
+        if merged["state"] not in ("on", "off"):
+            raise ValueError("state must be 'on' or 'off'")
+        intensity = merged["intensity"]
+        if isinstance(intensity, bool) or not isinstance(intensity, int) or not 0 <= intensity <= 100:
+            raise ValueError("intensity must be an integer from 0 to 100")
+        return merged
+    if isinstance(current, dict):
+        if not isinstance(patch, dict):
+            raise ValueError("expected an object with direction and/or degrees")
+        merged = dict(current)
+        for key, value in patch.items():
+            if key not in current or value is None:
+                raise ValueError(f"cannot set or remove '{key}'")
+            merged[key] = value
+        if merged["direction"] not in DIRECTIONS:
+            raise ValueError(f"direction must be one of {', '.join(DIRECTIONS)}")
+        degrees = merged["degrees"]
+        if isinstance(degrees, bool) or not isinstance(degrees, int) or not 0 <= degrees <= 180:
+            raise ValueError("degrees must be an integer from 0 to 180")
+        return merged
+    if patch not in ("on", "off"):
+        raise ValueError("state must be 'on' or 'off'")
+    return patch
+
+def is_dimmable(state):
+    """True for a device state with an intensity (a PWM light)"""
+    return isinstance(state, dict) and "intensity" in state
+
+def is_servo(state):
+    """True for a device state with a direction and angle"""
+    return isinstance(state, dict) and "direction" in state
+
+def reset_state(state):
+    """What a device shaped like state holds after the board resets"""
+    if is_servo(state):
+        return {"direction": "none", "degrees": 0}
+    if isinstance(state, dict):
+        return {"state": "off", "intensity": 0}
+    return "off"
+
+class SmartHomeController:
+    def __init__(self, 
+                 serial_port='COM5', 
+                 baud_rate=9600, 
+                 groq_api_key="your groq api key here",
+                 outbox_path="serial_outbox.json",
+                 outbox_max_pending=64,
+                 reconnect_interval=5.0,
+                 standby_ports=None,
+                 heartbeat_interval=1.0,
+                 heartbeat_deadline=0.3,
+                 heartbeat_misses=3,
+                 ack_timeout=2.0,
+                 max_baud_rate=115200,
+                 history_dir="state_history",
+                 llm_context=None):
+        """
+        Initialize Smart Home Controller with serial and Langchain components
+        """
+        # Updated Device State Dictionary
+        self.device_states = copy.deepcopy(DEFAULT_DEVICE_STATES)
+
+        # Monotonic state version; device_versions records the version at which
+        # each device last changed so clients can fetch only what they miss.
+        # Versions restart at 0 every boot, so tokens handed to clients carry
+        # boot_id and a token from an earlier boot is never taken as current
+        self.boot_id = uuid.uuid4().hex[:8]
+        self.state_version = 0
+        self.device_versions = {dev: 0 for dev in self.device_states}
+        self._state_lock = threading.Lock()
+        self._state_listeners = []
+
+        # Board reset state; advanced only when the firmware acknowledges delivery
+        self.acked_states = copy.deepcopy(self.device_states)
+        self._unconfirmed = {}
+
+        # Serial Communication Setup; ports may also be bridge URLs (see transport.py)
+        self.serial_ports = [serial_port] + list(standby_ports or [])
+        self._active_port = 0
+        self.serial_port = serial_port
+        self.baud_rate = baud_rate
+        self.reconnect_interval = reconnect_interval
+        self.ack_timeout = ack_timeout
+        self.rx_errors = 0  # Garbled or missing replies seen by the host
+        self.capabilities = set()  # Control commands the connected firmware advertises
+        self.firmware_devices = list(FIRMWARE_DEVICES)
+        self.device_groups = dict(DEVICE_GROUPS)
+        self.ser = None
+        self._standby = {}  # port index -> pre-opened standby link
+        self._serial_lock = threading.RLock()
+        # Serializes opening the link, which can take seconds, without blocking
+        # users of an open one; never taken while holding _serial_lock
+        self._open_lock = threading.Lock()
+        self._closing = False
+
+        # Updates accepted while the link is down survive restarts, so the
+        # host view starts from the last commanded state rather than all-off
+        self.outbox = SerialOutbox(path=outbox_path, max_pending=outbox_max_pending)
+        for dev, state in self.outbox.snapshot().items():
+            if dev in self.device_states:
+                self.device_states[dev] = state
+        self._outbox_event = threading.Event()
+        self._outbox_event.set()
+
+        # Change history for /history, starting from the state we come up in
+        self.history = StateHistory(directory=history_dir)
+        self.history.record(self.device_states)
+        self.add_state_listener(
+            lambda version, changed: self.history.record({dev: self.device_states[dev] for dev in changed
+                                                          if dev in self.device_states}))
+        self.bulk = BulkUploader(self)
+        self.pacer = FramePacer(baud_rate=baud_rate)
+        self._resends = 0       # Of the current batch, after missing CMD_OKs
+        self._resend_at = 0.0   # Monotonic time before which the batch is not retried
+        self._link_paused_until = 0.0  # Set while the board may be at another baud rate
+        threading.Thread(target=self._outbox_worker, daemon=True).start()
+        # Open the board now (it needs 2 s to reset) rather than on the first command
+        threading.Thread(target=self._open_serial, daemon=True).start()
+
+        # Heartbeat supervision with failover to standby boards; while the link is
+        # healthy the baud adapter runs it at the fastest rate the cable sustains
+        self.baud_adapter = BaudAdapter(self, max_baud=max_baud_rate) if max_baud_rate > baud_rate else None
+        self.link_monitor = None
+        if heartbeat_interval:
+            self.link_monitor = LinkMonitor(self, interval=heartbeat_interval, deadline=heartbeat_deadline,
+                                            quality=self.baud_adapter, misses_before_failover=heartbeat_misses)
+            self.link_monitor.start()
+
+        # Langchain components are shared between homes when a context (or a Future
+        # of one still loading in the background) is passed in
+        if llm_context is None:
+            llm_context = start_llm_context(groq_api_key=groq_api_key)
+        if not isinstance(llm_context, Future):
+            loaded, llm_context = llm_context, Future()
+            llm_context.set_result(loaded)
+        self._llm_context = llm_context
+        self.name_resolver = DeviceNameResolver(self.device_states)
+        # Identical commands arriving together share one LLM call and its result
+        self._inflight = SingleFlight()
+
+    @property
+    def llm_context(self):
+        """The shared LLM context, waiting for it if it is still loading"""
+        return self._llm_context.result()
+
+    @property
+    def llm(self):
+        return self.llm_context.llm
+
+    @property
+    def output_parser(self):
+        return self.llm_context.output_parser
+
+    @property
+    def chain(self):
+        return self.llm_context.chain
+
+    def llm_ready(self):
+        return self._llm_context.done() and self._llm_context.exception() is None
+
+    def readiness(self):
+        """What still has to come up before commands can be served"""
+        return {
+            "serial": self.ser is not None,
+            "llm": self.llm_ready(),
+            "llm_warm": "llm_warm" in STARTUP
+        }
 
     def parse_command(self, command: str) -> Dict[str, Any]:
+        """
+        Run a command through the LLM and apply it. Concurrent calls with the
+        same normalized command (a retry, or two panels at once) are collapsed
+        into one; every caller gets the same result, marked "collapsed" for the
+        ones that waited.
+        """
+        result, shared = self._inflight.do(command_key(command), self._parse_command, command)
+        return dict(result, collapsed=shared) if result else result
+
+    def _parse_command(self, command: str) -> Dict[str, Any]:
         try:
+            return self.apply_command_output(self.interpret(command))
+        except Exception as e:
+            logging.error(f"Command parsing error: {e}")
+            return None
+
+    def interpret(self, command: str) -> Dict[str, Any]:
+        """The LLM's parsed answer for a command; no state is touched, so it can run speculatively"""
+        with PROFILER.stage("llm_wait"), self.llm_context.validating_for(self):
             result = self.chain.run(command=command)
-            print(result)
-            parsed_output = self.output_parser.parse(result)
-            
-            # Update device states from parsed output
-            device_states = parsed_output.get("device_states", {})
-            light_intensity = parsed_output.get("light_intensity", {})
-            servo_motor_angle = parsed_output.get("servo_motor_angle", None)
-            servo_motor_direction = parsed_output.get("servo_motor_direction", None)
-            
-            # Update device states
-            for device, state in device_states.items():
-                if device in self.device_states:
-                    if device in ["room 2 light", "room 3 light"]:
-                        # Handle intensity-controlled lights
-                        if isinstance(self.device_states[device], dict):
-                            if isinstance(state, dict):
-                                # If state is a dict, update both state and intensity
-                                self.device_states[device]["state"] = state.get("state", self.device_states[device]["state"])
-                                self.device_states[device]["intensity"] = state.get("intensity", self.device_states[device]["intensity"])
-                            else:
-                                # If state is a string (e.g., "on" or "off"), update only the state
-                                self.device_states[device]["state"] = state
-                    elif device == "Servo motor":
-                        # Handle servo motor
-                        if isinstance(state, dict):
-                            self.device_states[device]["direction"] = state.get("direction", self.device_states[device]["direction"])
-                            self.device_states[device]["degrees"] = state.get("degrees", self.device_states[device]["degrees"])
+        print(result)
+        with PROFILER.stage("json_parse"):
+            return self.output_parser.parse(result)
+
+    def apply_command_output(self, parsed_output: Dict[str, Any]) -> Dict[str, Any]:
+        """Merge a parsed answer (from the LLM or the fast path) into the state and version it"""
+        with PROFILER.stage("state_merge"):
+            previous_states = copy.deepcopy(self.device_states)
+            unresolved = self.apply_parsed_output(self.device_states, parsed_output, self.name_resolver)
+            changed_devices = [dev for dev, state in self.device_states.items()
+                               if state != previous_states.get(dev)]
+            state_version = self.mark_changed(changed_devices)
+
+        mark_startup("first_command")
+        return {
+            "device_states": self.device_states,
+            "changed_devices": changed_devices,
+            "state_version": state_version,
+            "unresolved_devices": unresolved,
+            "chatbot_message": parsed_output.get("chatbot_message", "Command processed"),
+            "delay_seconds": int(parsed_output.get("delay_seconds", 0))
+        }
+
+    @staticmethod
+    def apply_parsed_output(device_states, parsed_output, resolver=None):
+        """
+        Merge one parsed LLM answer into device_states in place; kept free of
+        controller state so the prompt evaluation harness can score answers offline.
+        Device names are mapped to canonical ones first; returns the names that
+        could not be mapped, each with the reason, so they are reported rather than dropped.
+        """
+        resolver = resolver or DeviceNameResolver(device_states)
+        unresolved = []
+
+        def canonical(mapping):
+            resolved = {}
+            for name, value in (mapping or {}).items():
+                try:
+                    device = resolver.resolve(name)
+                except AmbiguousDeviceName as e:
+                    unresolved.append({"name": name, "reason": "ambiguous", "candidates": e.candidates})
+                    continue
+                if device is None:
+                    unresolved.append({"name": name, "reason": "unknown"})
+                else:
+                    resolved[device] = value
+            return resolved
+
+        # Update device states from parsed output
+        updates = canonical(parsed_output.get("device_states", {}))
+        light_intensity = canonical(parsed_output.get("light_intensity", {}))
+        servo_motor_angle = parsed_output.get("servo_motor_angle", None)
+        servo_motor_direction = parsed_output.get("servo_motor_direction", None)
+
+        # Update device states; what a device accepts follows the shape of its
+        # state, so devices added through the runtime table are handled alike
+        for device, state in updates.items():
+            if device in device_states:
+                if is_dimmable(device_states[device]):
+                    # Handle intensity-controlled lights
+                    if isinstance(state, dict):
+                        # If state is a dict, update both state and intensity
+                        device_states[device]["state"] = state.get("state", device_states[device]["state"])
+                        device_states[device]["intensity"] = state.get("intensity", device_states[device]["intensity"])
                     else:
-                        # Handle simple on/off devices
-                        self.device_states[device] = state
-            
-            # Update light intensities if provided
-            for light, intensity in light_intensity.items():
-                if light in ["room 2 light", "room 3 light"]:
-                    # Remove percentage sign if present and convert to integer
-                    if isinstance(intensity, str):
-                        intensity = intensity.rstrip('%')
-                    try:
-                        self.device_states[light]["intensity"] = int(intensity)
-                        # If intensity is being set, ensure the light is on
-                        if int(intensity) > 0:
-                            self.device_states[light]["state"] = "on"
-                        else:
-                            self.device_states[light]["state"] = "off"
-                    except (ValueError, TypeError):
-                        logging.error(f"Invalid intensity value: {intensity}")
-            
-            # Update servo motor properties if provided
-            if servo_motor_angle is not None:
+                        # If state is a string (e.g., "on" or "off"), update only the state
+                        device_states[device]["state"] = state
+                elif is_servo(device_states[device]):
+                    # Handle servo motor
+                    if isinstance(state, dict):
+                        device_states[device]["direction"] = state.get("direction", device_states[device]["direction"])
+                        device_states[device]["degrees"] = state.get("degrees", device_states[device]["degrees"])
+                else:
+                    # Handle simple on/off devices
+                    device_states[device] = state
+
+        # Update light intensities if provided
+        for light, intensity in light_intensity.items():
+            if is_dimmable(device_states.get(light)):
+                # Remove percentage sign if present and convert to integer
+                if isinstance(intensity, str):
+                    intensity = intensity.rstrip('%')
                 try:
-                    self.device_states["Servo motor"]["degrees"] = int(str(servo_motor_angle).rstrip('°'))
+                    device_states[light]["intensity"] = int(intensity)
+                    # If intensity is being set, ensure the light is on
+                    if int(intensity) > 0:
+                        device_states[light]["state"] = "on"
+                    else:
+                        device_states[light]["state"] = "off"
                 except (ValueError, TypeError):
-                    logging.error(f"Invalid servo angle value: {servo_motor_angle}")
-                    
-            if servo_motor_direction is not None:
-                self.device_states["Servo motor"]["direction"] = servo_motor_direction
-            
-            return {
-                "device_states": self.device_states,
-                "chatbot_message": parsed_output.get("chatbot_message", "Command processed"),
-                "delay_seconds": int(parsed_output.get("delay_seconds", 0))
-            }
-            
-        except Exception as e:
-            logging.error(f"Command parsing error: {e}")
+                    logging.error(f"Invalid intensity value: {intensity}")
+
+        # Update servo motor properties if provided; the answer format names no
+        # device, so they go to the first servo in the table
+        servo = next((dev for dev, state in device_states.items() if is_servo(state)), None)
+        if servo_motor_angle is not None and servo is not None:
+            try:
+                device_states[servo]["degrees"] = int(str(servo_motor_angle).rstrip('°'))
+            except (ValueError, TypeError):
+                logging.error(f"Invalid servo angle value: {servo_motor_angle}")
+
+        if servo_motor_direction is not None and servo is not None:
+            device_states[servo]["direction"] = servo_motor_direction
+
+        return unresolved
+
+    def mark_changed(self, devices):
+        """Bump the state version for the given changed devices and return the current version"""
+        with self._state_lock:
+            if devices:
+                self.state_version += 1
+                for dev in devices:
+                    self.device_versions[dev] = self.state_version
+            state_version = self.state_version
+        if devices:
+            for listener in self._state_listeners:
+                try:
+                    listener(state_version, list(devices))
+                except Exception as e:
+                    logging.error(f"State listener error: {e}")
+        return state_version
+
+    def add_state_listener(self, listener):
+        """Register listener(state_version, changed_devices), called after every state change"""
+        self._state_listeners.append(listener)
+
+    def apply_states(self, updates):
+        """
+        Replace the state of the given devices, queue the changed ones for the
+        microcontroller and return (state_version, changed_devices)
+        """
+        changed_devices = []
+        for dev, state in updates.items():
+            if dev in self.device_states and self.device_states[dev] != state:
+                self.device_states[dev] = copy.deepcopy(state)
+                changed_devices.append(dev)
+        state_version = self.mark_changed(changed_devices)
+        self.send_device_states(changed_devices)
+        return state_version, changed_devices
+
+    def merge_patch(self, patch):
+        """
+        Apply a JSON Merge Patch of device states, e.g. {"room 2 light": {"intensity": 40}}.
+        Devices left out keep their state. Every entry is validated against the
+        manifest and the device's state shape first, and nothing is applied if
+        any is invalid (InvalidStatePatch lists them all). Only the devices that
+        actually change are versioned and queued for the board; returns
+        (state_version, changed_devices).
+        """
+        if not isinstance(patch, dict):
+            raise InvalidStatePatch(["body must be a JSON object keyed by device name"])
+        updates, errors = {}, []
+        for dev, value in patch.items():
+            if dev not in self.device_states:
+                errors.append(f"{dev}: unknown device")
+                continue
+            try:
+                updates[dev] = merge_device_state(self.device_states[dev], value)
+            except ValueError as e:
+                errors.append(f"{dev}: {e}")
+        if errors:
+            raise InvalidStatePatch(errors)
+        return self.apply_states(updates)
+
+    def changes_since(self, version):
+        """Devices whose state changed after the given state version"""
+        return {dev: self.device_states[dev] for dev, changed_at in self.device_versions.items()
+                if changed_at > version and dev in self.device_states}
+
+    def state_token(self, version=None):
+        """Opaque "<boot_id>-<version>" token for ETags and ?since="""
+        return f"{self.boot_id}-{self.state_version if version is None else version}"
+
+    def token_version(self, token):
+        """State version in a token from this boot, or None for a stale or malformed one"""
+        boot_id, _, version = (token or "").rpartition("-")
+        if boot_id != self.boot_id or not version.isdigit():
             return None
+        return int(version)
+
+    def send_device_states(self, devices=None):
+        """
+        Queue device states for the microcontroller; the outbox worker delivers them.
+        Only the listed devices are queued, or every device when devices is None.
+        """
+        names = self.device_states.keys() if devices is None else devices
+        self.outbox.put({dev: self.device_states[dev] for dev in names if dev in self.device_states})
+        self._outbox_event.set()
+        return True
+
+    def _connect(self, port):
+        """
+        Open one link (a local port, or a tcp:// or rfc2217:// bridge URL),
+        returning None while it is unavailable
+        """
+        try:
+            ser = open_transport(port, baudrate=self.baud_rate, timeout=1)
+            print(f"Connected to serial port: {port}")
+            if is_local_port(port):
+                time.sleep(2)  # Allow microcontroller to reset
+            return ser
+        except (serial.SerialException, OSError) as e:
+            print(f"Error connecting to serial port: {e}")
+            return None
+
+    def _open_serial(self):
+        """Open the active serial port, returning False while the link is unavailable"""
+        with self._open_lock:
+            with self._serial_lock:
+                if self.ser is not None:
+                    return True
+                self.serial_port = self.serial_ports[self._active_port]
+                ser = self._standby.pop(self._active_port, None)
+            if ser is None:
+                # Not under _serial_lock: a local port needs 2 s for the board to reset
+                ser = self._connect(self.serial_port)
+            with self._serial_lock:
+                self.ser = ser
+                # A new board has to be timed from scratch
+                self.pacer.reset()
+                if self.ser is None:
+                    return False
+                mark_startup("serial_ready")
+                # Older firmware does not answer "caps" and gets per-device lines only
+                caps = self._query("caps", "CAPS,")
+                self.capabilities = set(caps.split(",")[1:]) if caps else set()
+                if "table" in self.capabilities:
+                    self.read_device_table()
+                # Opening a local port toggles DTR and resets the board to all-off;
+                # a standby or a reconnected bridge holds nothing we know of either
+                self._board_reset()
+                return True
+
+    def _warm_standby(self):
+        """Keep the next standby board open so failover skips the reset delay"""
+        if len(self.serial_ports) < 2:
+            return
+        index = (self._active_port + 1) % len(self.serial_ports)
+        if index not in self._standby:
+            ser = self._connect(self.serial_ports[index])
+            if ser is not None:
+                self._standby[index] = ser
+
+    def _board_reset(self):
+        """The board holds its reset state: forget what it acked and queue a full sync"""
+        with self._serial_lock:
+            self.acked_states = {dev: reset_state(state) for dev, state in self.device_states.items()}
+            self._unconfirmed = {}
+        self.outbox.request_resync()
+        self._outbox_event.set()
+
+    def _drop_serial(self):
+        """Forget a failed link so the outbox worker reconnects"""
+        with self._serial_lock:
+            try:
+                if self.ser:
+                    self.ser.close()
+            except Exception:
+                pass
+            self.ser = None
 
-    def send_device_states(self):
+    def _exchange(self, payload, timeout):
         """
-        Send device states to microcontroller sequentially
+        Send one frame and collect the reply lines until the firmware's CMD_OK.
+        Returns None if CMD_OK does not arrive within timeout seconds.
         """
+        with self._serial_lock, PROFILER.stage("serial_io"):
+            if self.ser is None:
+                return None
+            self.ser.reset_input_buffer()
+            self.ser.write(f"START{payload}END\n".encode('utf-8'))
+            deadline = time.monotonic() + timeout
+            lines = []
+            try:
+                while True:
+                    remaining = deadline - time.monotonic()
+                    if remaining <= 0:
+                        self.rx_errors += 1
+                        return None
+                    self.ser.timeout = remaining
+                    line = self.ser.readline().decode('utf-8', errors='replace').strip()
+                    if line == "CMD_OK":
+                        return lines
+                    if line == "ERR,OVF":
+                        logging.error(f"Frame too long for the firmware buffer: {len(payload)} bytes")
+                        return None
+                    if "\ufffd" in line:
+                        self.rx_errors += 1
+                    elif line:
+                        lines.append(line)
+            finally:
+                self.ser.timeout = 1
+
+    def _transact(self, payload, timeout):
+        """Send one frame and wait up to timeout seconds for the firmware's CMD_OK"""
+        return self._exchange(payload, timeout) is not None
+
+    def _query(self, payload, prefix, timeout=None):
+        """Send a firmware control command and return its reply line starting with prefix"""
         try:
-            if not self.ser.is_open:
-                self.ser.open()
-                
-            for dev, state in self.device_states.items():
-                # Prepare CSV output
-                output = io.StringIO()
-                csv_writer = csv.writer(output, delimiter=',')
-                
-                if isinstance(state, dict):
-                    if dev in ["room 2 light", "room 3 light"]:
-                        # Send light state and intensity
-                        csv_writer.writerow([dev, state["state"], state["intensity"]])
-                    elif dev == "Servo motor":
-                        # Send servo motor direction and degrees
-                        csv_writer.writerow([dev, state["direction"], state["degrees"]])
+            lines = self._exchange(payload, timeout or self.ack_timeout)
+        except (serial.SerialException, OSError) as e:
+            logging.error(f"Error querying microcontroller: {e}")
+            return None
+        for line in lines or []:
+            if line.startswith(prefix):
+                return line
+        return None
+
+    def read_device_stats(self):
+        """
+        Fetch the firmware's per-device on-time, switch count and time since last
+        change in one frame; returns None if the board does not answer. Devices
+        with a current sensor also get their load current and whether the
+        sensed load agrees with the commanded state.
+        """
+        line = self._query("stats", "STATS")
+        if line is None:
+            return None
+        stats = {}
+        for dev, record in zip(self.firmware_devices, line.split(";")[1:]):
+            fields = [int(x) for x in record.split(",")]
+            on_time_ms, switch_count, since_change_ms = fields[:3]
+            stats[dev] = {
+                "on_time_s": on_time_ms / 1000,
+                "switch_count": switch_count,
+                "since_change_s": since_change_ms / 1000
+            }
+            if len(fields) >= 5:
+                commanded_on = self.acked_states.get(dev) == "on"
+                stats[dev].update({
+                    "load_ma": fields[3],
+                    "load_running": bool(fields[4]),
+                    "load_confirmed": bool(fields[4]) == commanded_on
+                })
+        return stats
+
+    def read_device_table(self, reset=False):
+        """
+        Fetch the board's active device table and adopt its order and groups;
+        returns None if the board does not answer. With reset, every device in
+        the table is put back in its reset state on the host, as it just was
+        on the board.
+        """
+        line = self._query("table", "TABLE,")
+        if line is None:
+            return None
+        records = line.split(";")
+        types = {code: name for name, code in DEVICE_TYPES.items()}
+        table = []
+        for record in records[1:]:
+            name, io, groups = record.rsplit(",", 2)
+            io, groups = int(io), int(groups)
+            table.append({
+                "name": name,
+                "port": "D" if io & 0x80 else "B",
+                "pin": io & 0x07,
+                "type": types.get((io >> 3) & 0x03, "digital"),
+                "pwm": (io >> 5) & 0x03,
+                "groups": [g for g, flag in DEVICE_GROUP_FLAGS.items() if groups & flag]
+            })
+
+        self.firmware_devices = [device["name"] for device in table]
+        # Same order as deviceGroups[] in the firmware
+        self.device_groups = {
+            "all": [d["name"] for d in table if d["groups"]],
+            "lights": [d["name"] for d in table if "lights" in d["groups"]],
+            "loads": [d["name"] for d in table if "loads" in d["groups"]]
+        }
+        # Devices added on the board start in their reset state on the host
+        for device in table:
+            if reset or device["name"] not in self.device_states:
+                if device["type"] == "servo":
+                    self.device_states[device["name"]] = {"direction": "none", "degrees": 0}
+                elif device["type"] == "intensity":
+                    self.device_states[device["name"]] = {"state": "off", "intensity": 0}
                 else:
-                    # Send simple on/off state
-                    csv_writer.writerow([dev, state])
-                
-                # Send message with markers
-                message = f"START{output.getvalue().strip()}END\n"
-                self.ser.write(message.encode('utf-8'))
-                # print(message)
-                # print(f"Sent device state: {dev} = {state}")
-                # self.wait_for_ack()
-                time.sleep(0.3)
-            
+                    self.device_states[device["name"]] = "off"
+                self.device_versions.setdefault(device["name"], 0)
+                self.acked_states[device["name"]] = copy.deepcopy(self.device_states[device["name"]])
+                self._unconfirmed.pop(device["name"], None)
+        self.name_resolver = DeviceNameResolver(self.device_states)
+        return {"source": "eeprom" if records[0] == "TABLE,E" else "compiled-in", "devices": table}
+
+    def upload_device_table(self, devices):
+        """
+        Replace the board's device table at runtime: bulk-upload it to EEPROM,
+        have the firmware rebuild its index and re-read the result
+        """
+        if not self.bulk.upload("device_table", encode_device_table(devices)):
+            return None
+        if not self._transact("table,reload", self.ack_timeout):
+            return None
+        # The reload drove every output low, so the host follows it and
+        # re-sends the full state to be sure the two agree
+        table = self.read_device_table(reset=True)
+        if table is not None:
+            self.mark_changed([device["name"] for device in table["devices"]])
+            self.outbox.request_resync()
+            self._outbox_event.set()
+        return table
+
+    def _confirm_delivered(self):
+        """
+        Called after a heartbeat ack; the firmware handles frames in order, so
+        every frame written before the heartbeat has been applied
+        """
+        with self._serial_lock:
+            self.acked_states.update(self._unconfirmed)
+            self._unconfirmed = {}
+
+    def failover(self):
+        """
+        Switch to the next configured port; opening it queues a full sync. With a
+        single port the open link is kept: reopening a local port toggles DTR,
+        which resets the board, so the last-acked snapshot is replayed over it
+        instead.
+        """
+        standby = len(self.serial_ports) > 1
+        kept = not standby and self.ser is not None
+        with self._serial_lock:
+            # Anything the failed board never confirmed goes back to the outbox
+            self.outbox.put(self._unconfirmed)
+            self._unconfirmed = {}
+            if standby:
+                self._drop_serial()
+                self._active_port = (self._active_port + 1) % len(self.serial_ports)
+        # Outside the lock: opening a cold port waits out the board's reset
+        if not self._open_serial():
+            return False
+        if not kept:
+            # _open_serial already queued the full sync for the fresh board
             return True
-            
-        except Exception as e:
+
+        with self._serial_lock:
+            lines = self._format_lines(self.acked_states)
+            try:
+                self.ser.reset_input_buffer()
+                for frame in self._pack_frames(lines):
+                    if not self._transact(frame, self.ack_timeout):
+                        if standby:
+                            self._drop_serial()
+                        return False
+            except (serial.SerialException, OSError) as e:
+                logging.error(f"Error replaying state after failover: {e}")
+                self._drop_serial()
+                return False
+
+        self._outbox_event.set()
+        return True
+
+    def _outbox_worker(self):
+        """
+        Deliver queued updates whenever the serial link is up, reconnecting as needed
+        """
+        while not self._closing:
+            self._outbox_event.wait(self.reconnect_interval)
+            self._outbox_event.clear()
+            if self._closing or not self.outbox.has_work():
+                continue
+            if self.ser is None and not self._open_serial():
+                continue
+            # Outside the serial lock, so heartbeats get the link in between
+            retry_in = max(self._resend_at, self._link_paused_until) - time.monotonic()
+            if retry_in > 0:
+                time.sleep(retry_in)
+            self._flush_outbox()
+
+    def _flush_outbox(self):
+        """
+        Send everything in the outbox as one minimal sync, packing lines into as few frames as fit
+        """
+        pending, resync = self.outbox.take()
+        updates = copy.deepcopy(self.device_states) if resync else pending
+        lines = self._format_lines(updates)
+        try:
+            with self._serial_lock:
+                if self.ser is None:
+                    raise serial.SerialException("link dropped before flush")
+                for frame in self._pack_frames(lines):
+                    if not self._send_paced(frame):
+                        # No CMD_OK: the frame may never have been applied, so it must
+                        # not be confirmed by the next heartbeat. Re-send everything
+                        # (states are idempotent) after the pacer's backed-off gap, a
+                        # few times at most; a dead board is the link monitor's to detect.
+                        self.outbox.restore(pending, resync)
+                        self._resends += 1
+                        if self._resends <= MAX_RESENDS:
+                            logging.error(f"Frame not acknowledged, re-sending ({self._resends}/{MAX_RESENDS})")
+                            self._resend_at = time.monotonic() + self.pacer.gap()
+                            self._outbox_event.set()
+                            return False
+                        self._resends = 0
+                        self._resend_at = time.monotonic() + self.reconnect_interval
+                        if self.link_monitor is None:
+                            logging.error("Frame not acknowledged, reconnecting")
+                            self._drop_serial()
+                        else:
+                            logging.error("Frame not acknowledged, leaving the link to the heartbeat")
+                        return False
+                self._unconfirmed.update(copy.deepcopy(updates))
+                self._resends = 0
+            return True
+        except (serial.SerialException, OSError) as e:
             logging.error(f"Error sending device states: {e}")
+            self.outbox.restore(pending, resync)
+            self._drop_serial()
             return False
 
+    def _send_paced(self, frame):
+        """
+        Write one frame, time it until CMD_OK and wait the learned guard gap, so
+        unmodified boards run at their real speed instead of a fixed 0.3 s per frame
+        """
+        self.pacer.baud_rate = self.ser.baudrate
+        started = time.monotonic()
+        acked = self._transact(frame, self.pacer.ack_timeout(len(frame)))
+        self.pacer.observe(time.monotonic() - started, len(frame), acked)
+        time.sleep(self.pacer.gap())
+        return acked
+
+    def _format_lines(self, updates):
+        """
+        Render updates as firmware lines, collapsing complete groups whose members
+        all get the same state into one group line when the firmware supports it
+        """
+        remaining = dict(updates)
+        lines = []
+        if "group" in self.capabilities:
+            for group, members in self.device_groups.items():
+                line = self._format_group_line(group, [remaining.get(dev) for dev in members])
+                if line:
+                    lines.append(line)
+                    for dev in members:
+                        del remaining[dev]
+        lines.extend(self._format_device_line(dev, state) for dev, state in remaining.items())
+        return lines
+
+    @staticmethod
+    def _format_group_line(group, states):
+        """Group line for the given member states, or None if they are not all set alike"""
+        if any(state is None for state in states):
+            return None
+        switches = {state.get("state", "off") if isinstance(state, dict) else state for state in states}
+        if len(switches) != 1 or not switches <= {"on", "off"}:
+            return None
+        switch = switches.pop()
+        if switch == "off":
+            return f"group,{group},off"
+        intensities = {state.get("intensity", 0) for state in states if isinstance(state, dict)}
+        if len(intensities) > 1:
+            return None
+        return f"group,{group},on,{intensities.pop()}" if intensities else f"group,{group},on"
+
+    @staticmethod
+    def _format_device_line(dev, state):
+        """Render one device as the CSV line the firmware expects"""
+        output = io.StringIO()
+        csv_writer = csv.writer(output, delimiter=',')
+        if isinstance(state, dict):
+            if is_servo(state):
+                # Send servo motor direction and degrees
+                csv_writer.writerow([dev, state.get("direction", "none"), state.get("degrees", 0)])
+            else:
+                # Send light state and intensity
+                csv_writer.writerow([dev, state.get("state", "off"), state.get("intensity", 0)])
+        else:
+            # Send simple on/off state
+            csv_writer.writerow([dev, state])
+        return output.getvalue().strip()
+
+    @staticmethod
+    def _pack_frames(lines):
+        """Group CSV lines into newline-separated frame payloads under MAX_FRAME_PAYLOAD"""
+        frames = []
+        current = ""
+        for line in lines:
+            candidate = f"{current}\n{line}" if current else line
+            if current and len(candidate) > MAX_FRAME_PAYLOAD:
+                frames.append(current)
+                current = line
+            else:
+                current = candidate
+        if current:
+            frames.append(current)
+        return frames
+
+    def read_task_stats(self, reset=False):
+        """
+        Fetch the firmware scheduler's per-task run count, worst observed run
+        time and budget overruns, optionally clearing them; returns None if the
+        board does not answer or predates the scheduler
+        """
+        if "tasks" not in self.capabilities:
+            return None
+        line = self._query("tasks,reset" if reset else "tasks", "TASKS")
+        if line is None:
+            return None
+        tasks = {}
+        for record in line.split(";")[1:]:
+            name, runs, wcet_us, budget_us, overruns = record.split(",")
+            tasks[name] = {
+                "runs": int(runs),
+                "wcet_us": int(wcet_us),
+                "budget_us": int(budget_us),
+                "overruns": int(overruns)
+            }
+        return tasks
+
+    def read_event_log(self, from_eeprom=False):
+        """
+        Dump the firmware's event ring (or its EEPROM mirror from the last fault),
+        oldest first; returns None if the board does not answer
+        """
+        line = self._query("log,eeprom" if from_eeprom else "log", "LOG,")
+        if line is None:
+            return None
+        _, head, data = line.split(",", 2)
+        raw = bytes.fromhex(data)
+        records = [EVENT_RECORD.unpack_from(raw, offset)
+                   for offset in range(0, len(raw) - EVENT_RECORD.size + 1, EVENT_RECORD.size)]
+        # The ring is written at head modulo its size, so the oldest record sits there
+        start = int(head) % len(records) if records else 0
+        events = []
+        for tick, event_type, arg in records[start:] + records[:start]:
+            if event_type == 0:
+                continue  # Never written
+            if event_type == 2 and arg & 0x80 and (arg & 0x7F) < len(self.device_groups):
+                arg = "group " + list(self.device_groups)[arg & 0x7F]
+            elif event_type in (2, 7, 8) and arg < len(self.firmware_devices):
+                arg = self.firmware_devices[arg]
+            events.append({
+                "tick_ms": tick,
+                "event": EVENT_TYPES.get(event_type, str(event_type)),
+                "arg": arg
+            })
+        return events
+
     def wait_for_ack(self):
         """Wait for acknowledgment from the microcontroller"""
         try:
@@ -228,67 +1110,365 @@ class SmartHomeController:
         except Exception as e:
             print(f"Error waiting for acknowledgment: {e}")
 
+    def metrics(self):
+        """Operational counters for the /metrics endpoint"""
+        return {
+            "outbox": {
+                "pending": len(self.outbox),
+                "dropped": self.outbox.dropped,
+                "resync_required": self.outbox.resync_required
+            },
+            "link": self.link_monitor.snapshot() if self.link_monitor else None,
+            "uart": self.baud_adapter.metrics if self.baud_adapter else None,
+            "bulk": self.bulk.metrics,
+            "pacing": self.pacer.snapshot(),
+            "llm": self.llm.metrics if self.llm_ready() else None,
+            "llm_inflight": self._inflight.metrics,
+            "startup": STARTUP
+        }
+
     def close(self):
         """Close serial connection"""
+        self._closing = True
+        self._outbox_event.set()
+        self.history.flush()
+        if self.link_monitor:
+            self.link_monitor.stop()
+        for ser in self._standby.values():
+            ser.close()
         if self.ser:
             self.ser.close()
             print("Serial connection closed")
 
 
-def create_flask_app(controller):
+def create_flask_app(homes):
     """
-    Create Flask application with voice command and direct command endpoints
+    Create Flask application with voice command and direct command endpoints.
+    homes is a HomeRegistry, or a single controller served as the default home;
+    every endpoint is available both at its plain path (default home) and under
+    /homes/<home_id>/.
     """
     app = Flask(__name__)
+    registry = homes
+    if not isinstance(homes, HomeRegistry):
+        registry = HomeRegistry(factory=None)
+        registry.homes[registry.default_home_id] = homes
+
+    def unknown_home(home_id):
+        return jsonify({
+            'status': 'error',
+            'message': f'Unknown home: {home_id}'
+        }), 404
+
+    # Streaming transcripts from every home share the delayed-command timer thread
+    transcripts = TranscriptStreams(registry.scheduler)
+
+    def dispatch_command_result(controller, parsed_result):
+        """Queue an applied command for the board and build the JSON reply"""
+        delay_seconds = int(parsed_result.get("delay_seconds", 0))
+        changed_devices = parsed_result["changed_devices"]
+        # Queue sending device states on the shared scheduler (immediately or after the delay)
+        registry.scheduler.schedule(max(delay_seconds, 0), controller.send_device_states, changed_devices)
+        if delay_seconds > 0:
+            print(f"Command scheduled to execute after {delay_seconds} seconds.")
+        return {
+            'status': 'success',
+            'message': parsed_result['chatbot_message'],
+            'state_version': parsed_result['state_version'],
+            'state_token': controller.state_token(parsed_result['state_version']),
+            'changed': {dev: controller.device_states[dev] for dev in changed_devices},
+            # Device names the model used that match nothing, or more than one device
+            'unresolved': parsed_result['unresolved_devices']
+        }
+
+    # Request boundaries for the sampling profiler; no-ops unless a run is active
+    app.before_request(PROFILER.begin_request)
+    app.teardown_request(lambda exc: PROFILER.end_request())
+
+    @app.route('/homes', methods=['GET'])
+    def list_homes():
+        return jsonify(registry.overhead())
+
+    @app.route('/ready', methods=['GET'])
+    @app.route('/homes/<home_id>/ready', methods=['GET'])
+    def get_ready(home_id=None):
+        """200 once the serial link and the LLM are up, 503 before; includes the startup timeline"""
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        readiness = controller.readiness()
+        ready = readiness["serial"] and readiness["llm"]
+        return jsonify({
+            'status': 'ready' if ready else 'starting',
+            'components': readiness,
+            'startup': STARTUP
+        }), 200 if ready else 503
+
+    @app.route('/admin/profile', methods=['POST'])
+    def profile():
+        """
+        Sample the whole process for ?seconds=N or until ?requests=N requests
+        finish and return collapsed stacks, prefixed with the request stage
+        (llm_wait, json_parse, state_merge, serial_io), for flamegraph.pl or
+        speedscope. Only served to loopback clients.
+        """
+        if request.remote_addr not in ('127.0.0.1', '::1'):
+            return jsonify({
+                'status': 'error',
+                'message': 'Profiling is only available from localhost'
+            }), 403
+        seconds = request.args.get('seconds', type=float)
+        requests_count = request.args.get('requests', type=int)
+        if not seconds and not requests_count:
+            seconds = 10.0
+        try:
+            stacks = PROFILER.run(seconds=seconds, requests=requests_count)
+        except RuntimeError as e:
+            return jsonify({'status': 'error', 'message': str(e)}), 409
+        return Response(stacks, mimetype='text/plain')
     
     @app.route('/voice-command', methods=['POST'])
-    def receive_voice_command():
+    @app.route('/homes/<home_id>/voice-command', methods=['POST'])
+    def receive_voice_command(home_id=None):
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
         command = request.form.get('command', '')
         
         if command:
             parsed_result = controller.parse_command(command)
             
             if parsed_result:
-                delay_seconds = int(parsed_result.get("delay_seconds", 0))
-                if delay_seconds > 0:
-                    # Schedule sending device states after the delay
-                    threading.Timer(delay_seconds, controller.send_device_states).start()
-                    print(f"Command scheduled to execute after {delay_seconds} seconds.")
-                else:
-                    # Execute immediately in a separate thread
-                    threading.Thread(target=controller.send_device_states, daemon=True).start()
-                    
-                return jsonify({
-                    'status': 'success', 
-                    'message': parsed_result['chatbot_message'],
-                    'device_states': controller.device_states
-                })
+                return jsonify(dispatch_command_result(controller, parsed_result))
         
         return jsonify({
             'status': 'error', 
             'message': 'No command received'
         })
 
-    @app.route('/command', methods=['POST'])
-    def receive_direct_command():
+    @app.route('/voice-stream', methods=['POST'])
+    @app.route('/homes/<home_id>/voice-stream', methods=['POST'])
+    def receive_voice_stream(home_id=None):
+        """
+        Partial transcripts: form fields session, then text (the full hypothesis
+        so far) or chunk (words to append), and final=1 on the last update,
+        which applies the command and answers like /voice-command
+        """
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        session_id = request.form.get('session', '')
+        if not session_id:
+            return jsonify({
+                'status': 'error',
+                'message': 'No session given'
+            }), 400
+        text, chunk = request.form.get('text'), request.form.get('chunk')
+
+        if request.form.get('final') != '1':
+            partial = transcripts.update(home_id, session_id, controller, text, chunk)
+            return jsonify(dict(partial, status='partial', session=session_id))
+
+        parsed_result = transcripts.commit(home_id, session_id, controller, text, chunk)
+        if not parsed_result:
+            return jsonify({
+                'status': 'error',
+                'message': 'Command could not be processed'
+            }), 422
+        return jsonify(dict(dispatch_command_result(controller, parsed_result), path=parsed_result['path']))
+
+    @app.route('/status', methods=['GET'])
+    @app.route('/homes/<home_id>/status', methods=['GET'])
+    def get_status(home_id=None):
+        """
+        Conditional state read: the ETag is the state token, so clients that are
+        up to date get an empty 304. With ?since=<state_token> only newer devices
+        are returned; a token from before a restart gets the full state.
+        """
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        state_version = controller.state_version
+        etag = controller.state_token(state_version)
+        if request.if_none_match.contains(etag):
+            return Response(status=304, headers={'ETag': f'"{etag}"'})
+
+        body = {'state_version': state_version, 'state_token': etag}
+        since = controller.token_version(request.args.get('since'))
+        if since is None:
+            body['device_states'] = controller.device_states
+        else:
+            body['changed'] = controller.changes_since(since)
+        response = jsonify(body)
+        response.set_etag(etag)
+        return response
+
+    @app.route('/metrics', methods=['GET'])
+    @app.route('/homes/<home_id>/metrics', methods=['GET'])
+    def get_metrics(home_id=None):
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        return jsonify(dict(controller.metrics(), voice_stream=transcripts.metrics))
+
+    @app.route('/device-stats', methods=['GET'])
+    @app.route('/homes/<home_id>/device-stats', methods=['GET'])
+    def get_device_stats(home_id=None):
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        stats = controller.read_device_stats()
+        if stats is None:
+            return jsonify({
+                'status': 'error',
+                'message': 'Microcontroller did not answer'
+            }), 503
+        return jsonify({'status': 'success', 'device_stats': stats})
+
+    @app.route('/event-log', methods=['GET'])
+    @app.route('/homes/<home_id>/event-log', methods=['GET'])
+    def get_event_log(home_id=None):
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        events = controller.read_event_log(from_eeprom=request.args.get('source') == 'eeprom')
+        if events is None:
+            return jsonify({
+                'status': 'error',
+                'message': 'Microcontroller did not answer'
+            }), 503
+        return jsonify({'status': 'success', 'events': events})
+
+    @app.route('/firmware-tasks', methods=['GET'])
+    @app.route('/homes/<home_id>/firmware-tasks', methods=['GET'])
+    def get_firmware_tasks(home_id=None):
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        tasks = controller.read_task_stats(reset=request.args.get('reset') == '1')
+        if tasks is None:
+            return jsonify({
+                'status': 'error',
+                'message': 'Microcontroller did not answer'
+            }), 503
+        return jsonify({'status': 'success', 'tasks': tasks})
+
+    @app.route('/bulk/<kind>', methods=['POST'])
+    @app.route('/homes/<home_id>/bulk/<kind>', methods=['POST'])
+    def upload_bulk(kind, home_id=None):
+        """Upload the raw request body as a scenes, rules or device_table blob"""
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        try:
+            uploaded = controller.bulk.upload(kind, request.get_data())
+        except ValueError as e:
+            return jsonify({'status': 'error', 'message': str(e)}), 400
+        if not uploaded:
+            return jsonify({
+                'status': 'error',
+                'message': 'Bulk upload failed'
+            }), 503
+        return jsonify({'status': 'success', 'message': f'{kind} uploaded'})
+
+    @app.route('/history', methods=['GET'])
+    @app.route('/homes/<home_id>/history', methods=['GET'])
+    def get_history(home_id=None):
+        """
+        ?device=<name>&start=<epoch s>&end=<epoch s>&buckets=<n>: on-time and mean
+        intensity (or servo angle) per bucket; defaults to the last 7 days in daily buckets
+        """
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        device = request.args.get('device', '')
+        if device not in controller.device_states:
+            return jsonify({'status': 'error', 'message': f'Unknown device: {device}'}), 404
+        end = request.args.get('end', default=time.time(), type=float)
+        start = request.args.get('start', default=end - 7 * 86400, type=float)
+        buckets = request.args.get('buckets', default=7, type=int)
+        if start >= end or not 1 <= buckets <= 1000:
+            return jsonify({'status': 'error', 'message': 'Need start < end and 1-1000 buckets'}), 400
+        return jsonify({'status': 'success', 'history': controller.history.query(device, start, end, buckets)})
+
+    @app.route('/device-table', methods=['GET', 'POST'])
+    @app.route('/homes/<home_id>/device-table', methods=['GET', 'POST'])
+    def device_table(home_id=None):
+        """
+        GET returns the board's active device table; POST replaces it with a JSON list of
+        {"name", "port": "B"|"D", "pin", "type": "digital"|"servo"|"intensity", "pwm", "groups"}
+        """
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
+        if request.method == 'POST':
+            try:
+                table = controller.upload_device_table(request.get_json() or [])
+            except (ValueError, KeyError, TypeError) as e:
+                return jsonify({'status': 'error', 'message': f'Invalid device table: {e}'}), 400
+        else:
+            table = controller.read_device_table()
+        if table is None:
+            return jsonify({
+                'status': 'error',
+                'message': 'Microcontroller did not answer'
+            }), 503
+        if table['source'] != 'eeprom' and request.method == 'POST':
+            return jsonify({
+                'status': 'error',
+                'message': 'Firmware rejected the device table and kept the compiled-in one',
+                'device_table': table
+            }), 422
+        return jsonify({'status': 'success', 'device_table': table})
+
+    @app.route('/command', methods=['POST', 'PATCH'])
+    @app.route('/homes/<home_id>/command', methods=['POST', 'PATCH'])
+    def receive_direct_command(home_id=None):
+        """
+        Partial update: the body is a JSON Merge Patch (application/json or
+        application/merge-patch+json) naming only the devices to change; the
+        reply holds just the devices that changed
+        """
+        controller = registry.get(home_id)
+        if controller is None:
+            return unknown_home(home_id)
         try:
-            new_states = request.get_json()
-            print(new_states)
-            if not new_states:
+            with PROFILER.stage("json_parse"):
+                patch = request.get_json(silent=True)
+            print(patch)
+            if not isinstance(patch, dict):
                 return jsonify({
                     'status': 'error',
-                    'message': 'No state data received'
+                    'message': 'Body must be a JSON object keyed by device name'
                 }), 400
-            # Directly replace the device states
-            controller.device_states = new_states
-            
-            # Send updated states to Arduino
-            threading.Thread(target=controller.send_device_states, daemon=True).start()
+            if not patch:
+                # RFC 7396: an empty patch is a valid no-op
+                state_version = controller.state_version
+                return jsonify({
+                    'status': 'success',
+                    'message': 'No changes',
+                    'state_version': state_version,
+                    'state_token': controller.state_token(state_version),
+                    'changed': {}
+                })
+            with PROFILER.stage("state_merge"):
+                try:
+                    # Changed devices go straight to the outbox
+                    state_version, changed_devices = controller.merge_patch(patch)
+                except InvalidStatePatch as e:
+                    return jsonify({
+                        'status': 'error',
+                        'message': 'Invalid device states',
+                        'errors': e.errors
+                    }), 422
+            mark_startup("first_command")
             
             return jsonify({
                 'status': 'success',
                 'message': 'Device states updated',
-                'device_states': controller.device_states
+                'state_version': state_version,
+                'state_token': controller.state_token(state_version),
+                'changed': {dev: controller.device_states[dev] for dev in changed_devices}
             })
 
         except Exception as e:
@@ -299,23 +1479,54 @@ def create_flask_app(controller):
     
     return app
 
+def load_home_config(path=HOMES_CONFIG):
+    """
+    Read {home_id: controller kwargs} from a JSON file; without one the process
+    serves a single home on the default port
+    """
+    if not os.path.exists(path):
+        return {"default": {}}
+    with open(path, "r", encoding="utf-8") as f:
+        homes = json.load(f)
+    for home_id, kwargs in homes.items():
+        kwargs.setdefault("outbox_path", f"serial_outbox_{home_id}.json")
+        kwargs.setdefault("history_dir", f"state_history_{home_id}")
+    return homes
+
 def main():
     """
     Main application entry point
     """
     try:
-        # Initialize Smart Home Controller
-        controller = SmartHomeController()
-        
+        # One LLM context for all homes, loaded while the boards reset and Flask starts
+        llm_context = start_llm_context()
+        homes = load_home_config()
+        default_home_id = next(iter(homes))
+
+        def start_local_api(home_id, controller):
+            # Binary API for local automation clients (POSIX only), one socket per home
+            if hasattr(socket, "AF_UNIX"):
+                path = DEFAULT_SOCKET_PATH if home_id == default_home_id else home_socket_path(home_id)
+                LocalApiServer(controller, path).start()
+
+        registry = HomeRegistry(
+            factory=lambda **kwargs: SmartHomeController(llm_context=llm_context, **kwargs),
+            default_home_id=default_home_id,
+            start_services=start_local_api
+        )
+        for home_id, kwargs in homes.items():
+            registry.add_home(home_id, **kwargs)
+
         # Create and run Flask app
-        app = create_flask_app(controller)
-        app.run(host='0.0.0.0', port=5000, debug=True)
+        app = create_flask_app(registry)
+        mark_startup("http_ready")
+        app.run(host='0.0.0.0', port=5000, debug=True, use_reloader=False)
 
     except Exception as e:
         print(f"Fatal error: {e}")
     finally:
-        if 'controller' in locals():
-            controller.close()
+        if 'registry' in locals():
+            registry.close()
 
 if __name__ == "__main__":
     main()
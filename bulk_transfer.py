@@ -0,0 +1,161 @@
+import logging
+import time
+from typing import Optional
+
+import serial
+
+BULK_CHUNK_BYTES = 32       # Must match BULK_CHUNK_BYTES in the firmware
+BULK_KINDS = {"device_table": "D", "scenes": "S", "rules": "R"}
+BULK_AREA_SIZE = 272
+
+# Device table records, matching DEVICE_IO and GROUP_* in the firmware
+DEVICE_TYPES = {"digital": 0, "servo": 1, "intensity": 2}
+DEVICE_GROUP_FLAGS = {"lights": 1, "loads": 2}
+
+
+def crc_ccitt(data: bytes) -> int:
+    """CRC-16 matching avr-libc's _crc_ccitt_update (reflected 0x8408, initial 0xFFFF)"""
+    crc = 0xFFFF
+    for byte in data:
+        byte ^= crc & 0xFF
+        byte = (byte ^ (byte << 4)) & 0xFF
+        crc = (((byte << 8) | (crc >> 8)) ^ (byte >> 4) ^ (byte << 3)) & 0xFFFF
+    return crc
+
+
+def encode_device_table(devices) -> bytes:
+    """
+    Pack [{"name", "port": "B"|"D", "pin", "type", "pwm", "groups"}, ...] into the
+    firmware's device table blob: count, then per device name length, name,
+    io byte and group flags. The firmware re-validates pins when it loads it.
+    """
+    blob = bytearray([len(devices)])
+    for device in devices:
+        name = device["name"].encode("utf-8")
+        if not 0 < len(name) < 32 or b"," in name or b"\n" in name:
+            raise ValueError(f"Invalid device name: {device['name']!r}")
+        port_d = {"B": 0, "D": 1}[device["port"].upper()]
+        pin = int(device["pin"])
+        pwm = int(device.get("pwm", 0))
+        if not 0 <= pin <= 7 or not 0 <= pwm <= 2:
+            raise ValueError(f"Invalid pin or PWM channel for {device['name']}")
+        io = (port_d << 7) | (pwm << 5) | (DEVICE_TYPES[device.get("type", "digital")] << 3) | pin
+        groups = sum(DEVICE_GROUP_FLAGS[g] for g in device.get("groups", []))
+        blob += bytes([len(name)]) + name + bytes([io, groups])
+    if len(blob) > BULK_AREA_SIZE:
+        raise ValueError(f"Device table is {len(blob)} bytes, the firmware holds {BULK_AREA_SIZE}")
+    return bytes(blob)
+
+
+class BulkUploader:
+    """
+    Streams a blob to the firmware in sequence-numbered chunk frames.
+
+    The firmware answers each chunk with ACK,<seq>,<credits>, where credits is how
+    many more chunk frames its receive ring can hold. Up to that many frames are
+    kept in flight, so the link runs at full rate with no sleeps; a NAK or a
+    timeout rewinds to the first unacknowledged chunk (go-back-N). Replies to
+    frames sent before a rewind are skipped, so each rewind counts as one retry;
+    more than max_retries in a row without progress abort the upload.
+    """
+
+    def __init__(self, controller, timeout: float = 2.0, max_retries: int = 5):
+        self.controller = controller
+        self.timeout = timeout
+        self.max_retries = max_retries
+        self.metrics = {"uploads": 0, "failed_uploads": 0, "retransmits": 0, "last_upload_bytes_per_s": None}
+
+    def upload(self, kind: str, data: bytes) -> bool:
+        """Upload data into the firmware's EEPROM area for kind (device_table, scenes or rules)"""
+        if kind not in BULK_KINDS or not 0 < len(data) <= BULK_AREA_SIZE:
+            raise ValueError(f"Bulk upload needs a known kind and 1-{BULK_AREA_SIZE} bytes")
+        controller = self.controller
+        chunks = [data[i:i + BULK_CHUNK_BYTES] for i in range(0, len(data), BULK_CHUNK_BYTES)]
+        started = time.monotonic()
+        try:
+            with controller._serial_lock:
+                if controller.ser is None:
+                    return self._failed("link down")
+                controller.ser.reset_input_buffer()
+                self._send(f"bulk,begin,{BULK_KINDS[kind]},{len(data)}")
+                reply = self._wait_for({"BEGIN"})
+                if reply is None or reply[0] != "ACK":
+                    return self._failed("begin rejected")
+                credits = reply[2]
+
+                next_seq, acked, retries = 0, -1, 0
+                in_flight, stale = 0, 0  # Replies due; of those, replies to frames sent before a rewind
+                while acked < len(chunks) - 1:
+                    # Keep at most credits frames beyond the last acknowledged chunk in flight
+                    while next_seq < len(chunks) and next_seq - (acked + 1) < max(credits, 1):
+                        self._send(f"bulk,{next_seq},{chunks[next_seq].hex().upper()}")
+                        next_seq += 1
+                        in_flight += 1
+                    reply = self._read_reply()
+                    if reply is None:
+                        retries += 1
+                        if retries > self.max_retries:
+                            return self._failed("no ack")
+                        self.metrics["retransmits"] += next_seq - (acked + 1)
+                        next_seq = acked + 1
+                        in_flight, stale = 0, 0
+                        continue
+                    in_flight = max(in_flight - 1, 0)
+                    status, seq, credits = reply
+                    if stale:
+                        # The firmware NAKs every frame after a lost one; those were already resent
+                        stale -= 1
+                        continue
+                    if status == "ACK" and seq.isdigit():
+                        acked = max(acked, int(seq))
+                        retries = 0
+                    elif status == "NAK" and seq.isdigit():
+                        retries += 1
+                        if retries > self.max_retries:
+                            return self._failed(f"chunk {seq} rejected {retries} times")
+                        self.metrics["retransmits"] += next_seq - int(seq)
+                        acked = int(seq) - 1
+                        next_seq = int(seq)
+                        stale = in_flight
+
+                self._send(f"bulk,end,{crc_ccitt(data):04X}")
+                reply = self._wait_for({"END", "CRC"})
+                if reply is None or reply[0] != "ACK":
+                    return self._failed("crc mismatch")
+        except (serial.SerialException, OSError) as e:
+            return self._failed(str(e))
+
+        elapsed = time.monotonic() - started
+        self.metrics["uploads"] += 1
+        self.metrics["last_upload_bytes_per_s"] = round(len(data) / elapsed) if elapsed else None
+        print(f"Uploaded {len(data)} bytes of {kind} in {elapsed * 1000:.0f} ms")
+        return True
+
+    def _send(self, payload: str):
+        self.controller.ser.write(f"START{payload}END\n".encode('utf-8'))
+
+    def _read_reply(self) -> Optional[tuple]:
+        """Next ACK/NAK line as (status, seq, credits); None on timeout"""
+        ser = self.controller.ser
+        deadline = time.monotonic() + self.timeout
+        try:
+            while time.monotonic() < deadline:
+                ser.timeout = max(deadline - time.monotonic(), 0.01)
+                line = ser.readline().decode('utf-8', errors='replace').strip()
+                parts = line.split(",")
+                if len(parts) == 3 and parts[0] in ("ACK", "NAK") and parts[2].isdigit():
+                    return parts[0], parts[1], int(parts[2])
+        finally:
+            ser.timeout = 1
+        return None
+
+    def _wait_for(self, seqs) -> Optional[tuple]:
+        while True:
+            reply = self._read_reply()
+            if reply is None or reply[1] in seqs:
+                return reply
+
+    def _failed(self, reason: str) -> bool:
+        self.metrics["failed_uploads"] += 1
+        logging.error(f"Bulk upload failed: {reason}")
+        return False
@@ -0,0 +1,124 @@
+import re
+import threading
+from collections import OrderedDict
+from typing import Dict, Iterable, List, Optional
+
+NUMBER_WORDS = {
+    "one": "1", "two": "2", "three": "3", "four": "4", "five": "5",
+    "first": "1", "second": "2", "third": "3", "fourth": "4", "fifth": "5"
+}
+FILLER_WORDS = {"the", "my", "a"}
+
+# Everyday names for the manifest devices; normalized like everything else
+DEFAULT_ALIASES = {
+    "tv": "TV",
+    "television": "TV",
+    "fridge": "Refrigerator",
+    "servo": "Servo motor",
+    "dc": "DC motor",
+    "fan": "DC motor",
+    "kitchen": "kitchen light"
+}
+
+
+class AmbiguousDeviceName(ValueError):
+    def __init__(self, name: str, candidates: List[str]):
+        super().__init__(f"'{name}' could be any of: {', '.join(candidates)}")
+        self.name = name
+        self.candidates = candidates
+
+
+def normalize(name: str) -> str:
+    """Lowercase, split digits from letters, drop punctuation and filler, spell numbers as digits"""
+    name = re.sub(r"(?<=[a-z])(?=\d)|(?<=\d)(?=[a-z])", " ", name.lower())
+    words = re.findall(r"[a-z0-9]+", name)
+    return " ".join(NUMBER_WORDS.get(w, w) for w in words if w not in FILLER_WORDS)
+
+
+def numbers(key: str) -> tuple:
+    """The numeric tokens of a normalized name, in order"""
+    return tuple(w for w in key.split() if w.isdigit())
+
+
+def bounded_distance(a: str, b: str, limit: int) -> int:
+    """Levenshtein distance if it is at most limit, otherwise limit + 1"""
+    if abs(len(a) - len(b)) > limit:
+        return limit + 1
+    previous = list(range(len(b) + 1))
+    for i, ca in enumerate(a, 1):
+        current = [i] + [0] * len(b)
+        for j, cb in enumerate(b, 1):
+            current[j] = min(previous[j] + 1, current[j - 1] + 1, previous[j - 1] + (ca != cb))
+        if min(current) > limit:
+            return limit + 1
+        previous = current
+    return min(previous[-1], limit + 1)
+
+
+class DeviceNameResolver:
+    """
+    Maps the names an LLM (or a user) gives devices onto canonical manifest names.
+
+    Exact normalized names and aliases hit a precomputed dict. Anything else is
+    compared against the indexed keys with the same numbers (so "room 10" can
+    never become "room 1") with an edit distance bounded by max_distance (no
+    typos allowed for keys of four characters or fewer); the last cache_size
+    results are cached, under a lock since one resolver serves every request
+    thread. A name whose closest keys belong to different devices, or a bare
+    kind such as "light" when a home has several, raises AmbiguousDeviceName
+    with the candidates instead of guessing.
+    """
+
+    def __init__(self, names: Iterable[str], aliases: Optional[Dict[str, str]] = None, max_distance: int = 2,
+                 cache_size: int = 1024):
+        self.max_distance = max_distance
+        self.cache_size = cache_size
+        self.names = list(names)
+        self._index: Dict[str, set] = {}
+        for name in self.names:
+            self._add(normalize(name), name)
+            # "room 2" for "room 2 light", "dc" for "DC motor"; the bare
+            # "light" or "motor" names every device of that kind
+            key = normalize(name)
+            for suffix in (" light", " motor"):
+                if key.endswith(suffix) and len(key) > len(suffix):
+                    self._add(key[:-len(suffix)], name)
+                    self._add(suffix.strip(), name)
+        for alias, name in (DEFAULT_ALIASES if aliases is None else aliases).items():
+            if name in self.names:
+                self._add(normalize(alias), name)
+        self._cache: "OrderedDict[str, Optional[str]]" = OrderedDict()
+        self._cache_lock = threading.Lock()
+
+    def _add(self, key: str, name: str):
+        self._index.setdefault(key, set()).add(name)
+
+    def resolve(self, name: str) -> Optional[str]:
+        """Canonical device name, or None if nothing is close enough"""
+        with self._cache_lock:
+            if name in self._cache:
+                self._cache.move_to_end(name)
+                return self._cache[name]
+        key = normalize(name)
+        matches = self._index.get(key)
+        if matches is None and len(key) > 4:
+            best = self.max_distance + 1
+            key_numbers = numbers(key)
+            for candidate, names in self._index.items():
+                # Only words may be misspelt; numbers have to match exactly
+                if numbers(candidate) != key_numbers:
+                    continue
+                distance = bounded_distance(key, candidate, min(best, self.max_distance))
+                if distance < best:
+                    best, matches = distance, set(names)
+                elif distance == best and distance <= self.max_distance:
+                    matches = matches | names
+        if matches and len(matches) > 1:
+            raise AmbiguousDeviceName(name, sorted(matches))
+        resolved = next(iter(matches)) if matches else None
+        with self._cache_lock:
+            self._cache[name] = resolved
+            self._cache.move_to_end(name)
+            if len(self._cache) > self.cache_size:
+                self._cache.popitem(last=False)
+        return resolved
@@ -1,4 +1,9 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
 #include <stdlib.h>
 #include <string.h>
 #include <util/delay.h>
@@ -7,7 +12,22 @@
 #define F_CPU 16000000UL
 #define BAUD_RATE 9600
 #define MAX_CSV_LENGTH 256
-#define MAX_DEVICES 8
+#define MAX_DEVICES 16
+#define DEVICE_HASH_SLOTS 32       // Power of two, at least twice MAX_DEVICES
+#define FOLD_PERIOD_MS 1000  // Fold on-time into the accumulators once a second
+#define EVENT_LOG_SIZE 32    // Power of two; 6 bytes per record
+#define EVENT_BURST_QUIET_MS 600000UL  // A fault after 10 min without one starts a new burst (and mirror)
+#define MIRROR_IDLE 0xFF
+#define BAUD_PROBATION_MS 3000     // Revert a baud change unless a frame arrives at the new rate
+#define RX_RING_SIZE 256           // uint8_t indices wrap for free
+#define TX_RING_SIZE 64            // Power of two; covers every reply but the long reports
+#define BULK_CHUNK_BYTES 32        // Payload bytes per bulk chunk (64 hex chars)
+#define BULK_FRAME_BYTES 96        // Worst-case chunk frame on the wire, one receive credit
+#define BULK_AREA_SIZE 272         // EEPROM bytes per bulk kind; 3 areas + event log mirror fill 1 KB
+#define SENSE_CHANNELS 3
+#define SENSE_ZERO_COUNTS 512      // Current sensor output at zero load (VCC / 2)
+#define SENSE_MA_PER_COUNT 29      // ACS712-5A: 26.4 mA per ADC count, times the sine form factor
+#define SENSE_EMA_SHIFT 5          // Averages in Q5; alpha 1/32 is ~20 ms at ~1.6 kHz per channel
 
 // Updated Pin Definitions
 #define ROOM1_LIGHT_PIN PB0    // Pin 8
@@ -24,90 +44,970 @@
 // Servo instance
 Servo myservo;
 
+// Device I/O packed into one byte: bit 7 port (0 PORTB, 1 PORTD), bits 5-6 PWM
+// channel (0 none, 1 OCR1A, 2 OCR1B), bits 3-4 type (0 digital, 1 servo,
+// 2 intensity control), bits 0-2 pin
+#define DEVICE_IO(port_d, pin, type, pwm) (((port_d) << 7) | ((pwm) << 5) | ((type) << 3) | (pin))
+#define IO_PORT_D(io) ((io) & 0x80)
+#define IO_PWM(io) (((io) >> 5) & 0x03)
+#define IO_TYPE(io) (((io) >> 3) & 0x03)
+#define IO_PIN(io) ((io) & 0x07)
+
+#define GROUP_LIGHTS (1 << 0)
+#define GROUP_LOADS (1 << 1)
+
 typedef struct {
     const char* name;
-    volatile uint8_t* port;
-    uint8_t pin;
-    uint8_t type;  // 0 for digital, 1 for servo, 2 for intensity control
+    uint8_t io;
+    uint8_t groups;
 } DeviceState;
 
-// Updated device states array
-DeviceState deviceStates[] = {
-    {"room 1 light", &PORTB, PB0, 0},
-    {"room 2 light", &PORTB, PB1, 2},  // With intensity control
-    {"room 3 light", &PORTB, PB2, 2},  // With intensity control
-    {"room 4 light", &PORTB, PB3, 0},
-    {"kitchen light", &PORTB, PB4, 0},
-    {"DC motor", &PORTD, PD4, 0},
-    {"Servo motor", &PORTD, PD5, 1},   // Servo type
-    {"Refrigerator", &PORTD, PD6, 0},
-    {"TV", &PORTD, PD7, 0}
+// Compiled-in table, used until a valid table has been uploaded to EEPROM
+const DeviceState deviceStates[] = {
+    {"room 1 light", DEVICE_IO(0, PB0, 0, 0), GROUP_LIGHTS},
+    {"room 2 light", DEVICE_IO(0, PB1, 2, 1), GROUP_LIGHTS},  // With intensity control
+    {"room 3 light", DEVICE_IO(0, PB2, 2, 2), GROUP_LIGHTS},  // With intensity control
+    {"room 4 light", DEVICE_IO(0, PB3, 0, 0), GROUP_LIGHTS},
+    {"kitchen light", DEVICE_IO(0, PB4, 0, 0), GROUP_LIGHTS},
+    {"DC motor", DEVICE_IO(1, PD4, 0, 0), GROUP_LOADS},
+    {"Servo motor", DEVICE_IO(1, PD5, 1, 0), 0},   // Servo type
+    {"Refrigerator", DEVICE_IO(1, PD6, 0, 0), GROUP_LOADS},
+    {"TV", DEVICE_IO(1, PD7, 0, 0), GROUP_LOADS}
 };
 
-const uint8_t NUM_DEVICES = sizeof(deviceStates) / sizeof(deviceStates[0]);
+#define NUM_DEFAULT_DEVICES (sizeof(deviceStates) / sizeof(deviceStates[0]))
+#define NAME_IN_FLASH 0xFFFF
 
-void init_pins() {
-    // Configure PORTB pins (8-12) as outputs for lights
-    DDRB |= (1 << PB0) | (1 << PB1) | (1 << PB2) | (1 << PB3) | (1 << PB4);
-    
-    // Configure PORTD pins (4-7) as outputs for other devices
-    DDRD |= (1 << PD4) | (1 << PD5) | (1 << PD6) | (1 << PD7);
-    
-    // Initialize all outputs to LOW
-    PORTB &= ~((1 << PB0) | (1 << PB1) | (1 << PB2) | (1 << PB3) | (1 << PB4));
-    PORTD &= ~((1 << PD4) | (1 << PD5) | (1 << PD6) | (1 << PD7));
-    
-    // Initialize servo
-    myservo.attach(SERVO_MOTOR_PIN);
-    myservo.write(90);  // Center position
+// Runtime device index, rebuilt from the active table at boot and on
+// "table,reload". Names stay in EEPROM (or the compiled-in table); RAM holds
+// 6 bytes per device plus an open-addressed hash of name -> device.
+typedef struct {
+    uint16_t hash;
+    uint16_t name_at;  // EEPROM offset of the length-prefixed name, or NAME_IN_FLASH
+    uint8_t io;
+    uint8_t groups;
+} DeviceSlot;
+
+DeviceSlot devices[MAX_DEVICES];
+uint8_t device_slots[DEVICE_HASH_SLOTS];  // Device index + 1, 0 when empty
+uint8_t num_devices = 0;
+uint8_t device_table_source = 'F';   // 'F' compiled-in, 'E' uploaded to EEPROM
+uint8_t output_mask[2];              // Configured outputs on PORTB and PORTD
+
+#define PWM_OCR1A (1 << 0)
+#define PWM_OCR1B (1 << 1)
+
+// Device groups as precomputed per-port masks: "group,<id>,<action>,<value>"
+// switches every member with a single read-modify-write per port. The masks
+// are derived from the members' group flags whenever the index is rebuilt.
+typedef struct {
+    const char* name;
+    uint8_t members;  // GROUP_* flags of the devices that belong
+    uint8_t portb_mask;
+    uint8_t portd_mask;
+    uint8_t pwm_mask;
+} DeviceGroup;
+
+DeviceGroup deviceGroups[] = {
+    {"all", GROUP_LIGHTS | GROUP_LOADS, 0, 0, 0},
+    {"lights", GROUP_LIGHTS, 0, 0, 0},
+    {"loads", GROUP_LOADS, 0, 0, 0}
+};
+
+const uint8_t NUM_GROUPS = sizeof(deviceGroups) / sizeof(deviceGroups[0]);
+
+// Per-device usage accumulators for energy and relay-wear estimates
+typedef struct {
+    uint32_t on_time_ms;   // On-time weighted by duty cycle (PWM level / 255)
+    uint32_t last_change;  // tick_ms of the last output change
+    uint32_t last_fold;    // tick_ms up to which on_time_ms is accounted
+    uint16_t switch_count; // Off->on/on->off transitions (servo: moves)
+    uint8_t level;         // Current output: 0-255 duty, or servo angle
+    uint8_t frac;          // Sub-millisecond remainder of on_time_ms, in 1/255 ms
+} DeviceStats;
+
+DeviceStats deviceStats[MAX_DEVICES];
+
+// Load current sensing on ADC0-ADC2 (PC0-PC2): the ADC free-runs over the
+// channels and the ISR keeps a rectified moving average per channel, so a
+// switched load can be confirmed without any host polling
+typedef struct {
+    const char* device;
+    uint8_t adc_channel;
+    uint16_t on_ma;   // Load counts as running above this
+    uint16_t off_ma;  // and as stopped again below this
+} SenseChannel;
+
+const SenseChannel senseChannels[SENSE_CHANNELS] = {
+    {"DC motor", 0, 150, 80},
+    {"Refrigerator", 1, 300, 150},
+    {"TV", 2, 100, 50}
+};
+
+volatile uint16_t sense_avg[SENSE_CHANNELS];  // |sample - zero| EMA in Q5 ADC counts
+volatile uint8_t sense_on = 0;                // Bit per channel, with hysteresis
+volatile uint8_t sense_changed = 0;           // Bits flipped since the sense task last logged them
+uint16_t sense_on_q5[SENSE_CHANNELS];
+uint16_t sense_off_q5[SENSE_CHANNELS];
+uint8_t sense_device[SENSE_CHANNELS];         // Device index per channel, 0xFF if not in the table
+
+volatile uint32_t tick_ms = 0;
+
+// Scheduler task ids, in priority order (highest first)
+enum { TASK_PROTOCOL = 0, TASK_SENSE = 1, TASK_FOLD = 2, TASK_MIRROR = 3, NUM_TASKS = 4 };
+volatile uint8_t task_ready = 0;  // Bit per event-driven task, set from interrupts
+
+// UART link quality counters since the last "uart" query
+typedef struct {
+    uint16_t rx;
+    uint16_t framing;
+    uint16_t overrun;
+    uint16_t parity;
+} UartCounters;
+
+UartCounters uart_window;  // Updated from the RX interrupt
+volatile uint8_t uart_error_flags = 0;  // Errors seen by the ISR, logged by the protocol task
+
+// Interrupt-driven receive ring so bytes keep arriving while a frame is processed
+volatile uint8_t rx_ring[RX_RING_SIZE];
+volatile uint8_t rx_head = 0;
+volatile uint8_t rx_tail = 0;
+// Replies are queued here and clocked out by the UDRE interrupt, so a task
+// only waits on the wire for the part of a reply that does not fit
+volatile uint8_t tx_ring[TX_RING_SIZE];
+volatile uint8_t tx_head = 0;
+volatile uint8_t tx_tail = 0;
+volatile uint32_t uart_baud = BAUD_RATE;
+uint32_t uart_previous_baud = BAUD_RATE;
+uint32_t uart_pending_baud = 0;
+volatile uint16_t baud_probation_ms = 0;
+
+const uint32_t SUPPORTED_BAUDS[] = {9600, 19200, 38400, 57600, 115200};
+
+void UART_set_baud(uint32_t baud);
+
+void UART_transmit_string(const char* str);
+void UART_transmit(const char* str);
+void UART_transmit_u32(uint32_t value);
+void UART_transmit_hex(uint8_t value);
+void send_task_stats(uint8_t reset);
+
+// Event log: fixed RAM ring of compact binary records for post-mortem debugging
+enum {
+    EVT_FRAME_RX = 1,       // arg: payload length
+    EVT_LINE_APPLIED = 2,   // arg: device index, or 0x80 | group index
+    EVT_UNKNOWN_DEVICE = 3, // arg: first character of the name
+    EVT_OVERFLOW = 4,       // arg: 0
+    EVT_UART_ERROR = 5,     // arg: UCSR0A error bits
+    EVT_DEVICE_TABLE = 6,   // arg: devices loaded from EEPROM, 0 for the compiled-in table
+    EVT_LOAD_ON = 7,        // arg: device index whose sensed current rose above on_ma
+    EVT_LOAD_OFF = 8        // arg: device index whose sensed current fell below off_ma
+};
+
+typedef struct {
+    uint32_t tick;
+    uint8_t type;
+    uint8_t arg;
+} EventRecord;
+
+EventRecord event_log[EVENT_LOG_SIZE];
+uint8_t event_head = 0;       // Total events logged, modulo 256
+uint8_t event_fault = 0;      // Set by the first fault of a burst, cleared when mirroring starts
+uint8_t event_faulted = 0;    // Any fault seen since reset
+uint32_t event_fault_at = 0;  // tick_ms of the latest fault
+uint8_t mirror_next = MIRROR_IDLE;  // Next record to mirror, EVENT_LOG_SIZE for the head byte
+uint8_t mirror_head = 0;
+
+EventRecord EEMEM ee_event_log[EVENT_LOG_SIZE];
+uint8_t EEMEM ee_event_head;
+
+static inline void log_event(uint8_t type, uint8_t arg) {
+    EventRecord* record = &event_log[event_head++ & (EVENT_LOG_SIZE - 1)];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        record->tick = tick_ms;
+    }
+    record->type = type;
+    record->arg = arg;
+    if (type >= EVT_OVERFLOW && type <= EVT_UART_ERROR) {
+        // Persistent errors keep one burst going, so the EEPROM is written once
+        // per burst rather than over and over
+        if (!event_faulted || record->tick - event_fault_at >= EVENT_BURST_QUIET_MS) {
+            event_fault = 1;
+        }
+        event_faulted = 1;
+        event_fault_at = record->tick;
+    }
 }
 
-void update_device_state(const char* device, const char* action, const char* value) {
-    for (uint8_t i = 0; i < NUM_DEVICES; i++) {
-        if (strcmp(deviceStates[i].name, device) == 0) {
-            switch (deviceStates[i].type) {
-                case 0:  // Digital ON/OFF
-                    if (strcmp(action, "on") == 0) {
-                        *(deviceStates[i].port) |= (1 << deviceStates[i].pin);
-                    } else {
-                        *(deviceStates[i].port) &= ~(1 << deviceStates[i].pin);
-                    }
-                    break;
-                    
-                case 1:  // Servo motor
-                    if (strcmp(action, "clock") == 0) {
-                        int angle = atoi(value);
-                        myservo.write(angle);
-                    } else if (strcmp(action, "anti") == 0) {
-                        int angle = atoi(value);
-                        myservo.write(180 - angle);
-                    }
-                    break;
-                    
-                case 2:  // Intensity control (PWM)
-                    if (strcmp(action, "on") == 0) {
-                        int intensity = atoi(value);
-                        // Map intensity (0-100) to PWM (0-255)
-                        int pwm_value = (intensity * 255) / 100;
-                        if (deviceStates[i].pin == PB1) {
-                            OCR1A = pwm_value;
-                        } else if (deviceStates[i].pin == PB2) {
-                            OCR1B = pwm_value;
-                        }
-                    } else {
-                        if (deviceStates[i].pin == PB1) {
-                            OCR1A = 0;
-                        } else if (deviceStates[i].pin == PB2) {
-                            OCR1B = 0;
-                        }
-                    }
-                    break;
+// Timer2 CTC at 1 kHz: 16 MHz / 64 / 250
+void init_tick() {
+    TCCR2A = (1 << WGM21);
+    TCCR2B = (1 << CS22);
+    OCR2A = 249;
+    TIMSK2 |= (1 << OCIE2A);
+}
+
+uint32_t get_ticks() {
+    uint32_t now;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        now = tick_ms;
+    }
+    return now;
+}
+
+// Microseconds from the tick and Timer2's count (4 us resolution), for task timing
+uint32_t get_micros() {
+    uint32_t ms;
+    uint8_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = tick_ms;
+        count = TCNT2;
+        // Compare match already happened but its interrupt is still pending
+        if ((TIFR2 & (1 << OCF2A)) && count < OCR2A) {
+            ms++;
+        }
+    }
+    return ms * 1000 + count * 4;
+}
+
+// Add the duty-weighted time since the last fold; callers hold interrupts off
+static void fold_on_time(uint8_t i, uint32_t now) {
+    DeviceStats* stats = &deviceStats[i];
+    if (stats->level && IO_TYPE(devices[i].io) != 1) {
+        uint32_t weighted = (now - stats->last_fold) * stats->level + stats->frac;
+        stats->on_time_ms += weighted / 255;
+        stats->frac = weighted % 255;
+    }
+    stats->last_fold = now;
+}
+
+ISR(TIMER2_COMPA_vect) {
+    tick_ms++;
+    // No frame arrived at a newly negotiated rate: fall back to the previous one
+    if (baud_probation_ms && --baud_probation_ms == 0) {
+        UART_set_baud(uart_previous_baud);
+    }
+}
+
+// AVcc reference, free-running auto trigger, 125 kHz ADC clock (~9.6k conversions/s)
+void init_adc() {
+    for (uint8_t c = 0; c < SENSE_CHANNELS; c++) {
+        sense_on_q5[c] = ((uint32_t)senseChannels[c].on_ma << SENSE_EMA_SHIFT) / SENSE_MA_PER_COUNT;
+        sense_off_q5[c] = ((uint32_t)senseChannels[c].off_ma << SENSE_EMA_SHIFT) / SENSE_MA_PER_COUNT;
+        DIDR0 |= (1 << senseChannels[c].adc_channel);
+    }
+    ADMUX = (1 << REFS0) | senseChannels[0].adc_channel;
+    ADCSRB = 0;
+    ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | (1 << ADSC) |
+             (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+}
+
+ISR(ADC_vect) {
+    static uint8_t channel = 0;
+    static uint8_t settling = 0;
+    uint16_t sample = ADC;
+
+    // In free-running mode the conversion after a MUX change was already
+    // started on the old channel; drop it
+    if (settling) {
+        settling = 0;
+        return;
+    }
+
+    int16_t level = (int16_t)sample - SENSE_ZERO_COUNTS;
+    if (level < 0) {
+        level = -level;
+    }
+    int16_t avg = sense_avg[channel];
+    avg += ((level << SENSE_EMA_SHIFT) - avg) >> SENSE_EMA_SHIFT;
+    sense_avg[channel] = avg;
+
+    uint8_t bit = 1 << channel;
+    if (!(sense_on & bit) && (uint16_t)avg > sense_on_q5[channel]) {
+        sense_on |= bit;
+        sense_changed |= bit;
+        task_ready |= (1 << TASK_SENSE);
+    } else if ((sense_on & bit) && (uint16_t)avg < sense_off_q5[channel]) {
+        sense_on &= ~bit;
+        sense_changed |= bit;
+        task_ready |= (1 << TASK_SENSE);
+    }
+
+    if (++channel == SENSE_CHANNELS) {
+        channel = 0;
+    }
+    ADMUX = (1 << REFS0) | senseChannels[channel].adc_channel;
+    settling = 1;
+}
+
+// Turn threshold crossings flagged by the ADC interrupt into event log records
+void log_sense_events() {
+    if (!sense_changed) {
+        return;
+    }
+    uint8_t changed, on;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        changed = sense_changed;
+        on = sense_on;
+        sense_changed = 0;
+    }
+    for (uint8_t c = 0; c < SENSE_CHANNELS; c++) {
+        if ((changed & (1 << c)) && sense_device[c] != 0xFF) {
+            log_event((on & (1 << c)) ? EVT_LOAD_ON : EVT_LOAD_OFF, sense_device[c]);
+        }
+    }
+}
+
+// Account a new output level for device i (duty 0-255, or servo angle)
+void record_device_change(uint8_t i, uint8_t level) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        DeviceStats* stats = &deviceStats[i];
+        fold_on_time(i, tick_ms);
+        if (IO_TYPE(devices[i].io) == 1 ? level != stats->level : (level != 0) != (stats->level != 0)) {
+            stats->switch_count++;
+        }
+        if (level != stats->level) {
+            stats->last_change = tick_ms;
+        }
+        stats->level = level;
+    }
+}
+
+// Sense channel wired to device i, or 0xFF if the device is not sensed
+static uint8_t sense_channel_of(uint8_t i) {
+    for (uint8_t c = 0; c < SENSE_CHANNELS; c++) {
+        if (sense_device[c] == i) {
+            return c;
+        }
+    }
+    return 0xFF;
+}
+
+// Bulk read: STATS;<on_ms>,<switches>,<ms since change>[,<load mA>,<load running>];...
+// in device table order; the load fields are present for sensed devices only
+void send_device_stats() {
+    DeviceStats snapshot;
+    uint32_t now;
+
+    UART_transmit("STATS");
+    for (uint8_t i = 0; i < num_devices; i++) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            now = tick_ms;
+            fold_on_time(i, now);
+            snapshot = deviceStats[i];
+        }
+        UART_transmit(";");
+        UART_transmit_u32(snapshot.on_time_ms);
+        UART_transmit(",");
+        UART_transmit_u32(snapshot.switch_count);
+        UART_transmit(",");
+        UART_transmit_u32(now - snapshot.last_change);
+
+        uint8_t c = sense_channel_of(i);
+        if (c != 0xFF) {
+            uint16_t avg;
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                avg = sense_avg[c];
             }
-            // Send acknowledgment
+            UART_transmit(",");
+            UART_transmit_u32(((uint32_t)avg * SENSE_MA_PER_COUNT) >> SENSE_EMA_SHIFT);
+            UART_transmit((sense_on & (1 << c)) ? ",1" : ",0");
+        }
+    }
+    UART_transmit_string("");
+}
+
+// Copy the ring to EEPROM at the start of a fault burst so it survives a
+// reset; runs as a scheduler task, one record per run
+void mirror_event_log() {
+    if (mirror_next == MIRROR_IDLE) {
+        if (!event_fault) {
+            return;
+        }
+        event_fault = 0;
+        mirror_next = 0;
+        // Records logged while the copy runs may land next to older ones; the
+        // ring stays readable from this head either way
+        mirror_head = event_head;
+    }
+    // EEPROM writes block ~3.3 ms per byte: write at most one changed record
+    // per run, skipping unchanged ones (reads are fast), head byte last
+    while (mirror_next < EVENT_LOG_SIZE) {
+        EventRecord stored;
+        uint8_t i = mirror_next++;
+        eeprom_read_block(&stored, &ee_event_log[i], sizeof(stored));
+        if (memcmp(&stored, &event_log[i], sizeof(stored)) != 0) {
+            eeprom_update_block(&event_log[i], &ee_event_log[i], sizeof(stored));
+            return;
+        }
+    }
+    eeprom_update_byte(&ee_event_head, mirror_head);
+    mirror_next = MIRROR_IDLE;
+}
+
+// Bulk dump: LOG,<head>,<records as hex> with each record tick(4) type(1) arg(1), little endian
+void send_event_log(uint8_t from_eeprom) {
+    EventRecord record;
+    uint8_t head = from_eeprom ? eeprom_read_byte(&ee_event_head) : event_head;
+
+    UART_transmit("LOG,");
+    UART_transmit_u32(head);
+    UART_transmit(",");
+    for (uint8_t i = 0; i < EVENT_LOG_SIZE; i++) {
+        if (from_eeprom) {
+            eeprom_read_block(&record, &ee_event_log[i], sizeof(record));
+        } else {
+            record = event_log[i];
+        }
+        const uint8_t* bytes = (const uint8_t*)&record;
+        for (uint8_t b = 0; b < sizeof(record); b++) {
+            UART_transmit_hex(bytes[b]);
+        }
+    }
+    UART_transmit_string("");
+}
+
+// Link quality: UART,<baud>,<bytes>,<framing>,<overrun>,<parity> for the window since the last query
+void send_uart_stats() {
+    UartCounters window;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        window = uart_window;
+        memset(&uart_window, 0, sizeof(uart_window));
+    }
+
+    UART_transmit("UART,");
+    UART_transmit_u32(uart_baud);
+    UART_transmit(",");
+    UART_transmit_u32(window.rx);
+    UART_transmit(",");
+    UART_transmit_u32(window.framing);
+    UART_transmit(",");
+    UART_transmit_u32(window.overrun);
+    UART_transmit(",");
+    UART_transmit_u32(window.parity);
+    UART_transmit_string("");
+}
+
+// Accept a baud change; it takes effect after CMD_OK has gone out at the old rate
+void request_baud(const char* value) {
+    uint32_t baud = strtoul(value, NULL, 10);
+    for (uint8_t i = 0; i < sizeof(SUPPORTED_BAUDS) / sizeof(SUPPORTED_BAUDS[0]); i++) {
+        if (SUPPORTED_BAUDS[i] == baud) {
+            uart_pending_baud = baud;
             UART_transmit_string("OK");
             return;
         }
     }
+    UART_transmit_string("ERR,BAUD");
+}
+
+void apply_pending_baud() {
+    if (!uart_pending_baud) {
+        return;
+    }
+    // Let the queued reply and then the last byte leave the shift register
+    // (about one character time at 9600)
+    while (tx_head != tx_tail);
+    while (!(UCSR0A & (1<<UDRE0)));
+    _delay_ms(2);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uart_previous_baud = uart_baud;
+        UART_set_baud(uart_pending_baud);
+        baud_probation_ms = BAUD_PROBATION_MS;
+    }
+    uart_pending_baud = 0;
+}
+
+// Bulk transfer: chunked, sequence-numbered uploads of scenes, rules and the
+// device table into per-kind EEPROM areas. Every chunk is acknowledged with the
+// number of further chunk frames the receive ring can absorb, so the host can
+// stream without sleeping and without overrunning us.
+//   bulk,begin,<kind D|S|R>,<length>  -> ACK,BEGIN,<credits>
+//   bulk,<seq>,<hex payload>          -> ACK,<seq>,<credits> | NAK,<expected seq>,<credits>
+//   bulk,end,<crc16 ccitt>            -> ACK,END,<credits>   | NAK,CRC,<credits>
+typedef struct {
+    uint16_t length;  // 0 while an upload is in progress or after a failed one
+    uint16_t crc;
+} BulkHeader;
+
+enum { BULK_DEVICE_TABLE = 0, BULK_SCENES = 1, BULK_RULES = 2, BULK_KINDS = 3 };
+
+uint8_t EEMEM ee_bulk_data[BULK_KINDS][BULK_AREA_SIZE];
+BulkHeader EEMEM ee_bulk_header[BULK_KINDS];
+
+uint8_t bulk_kind = 0xFF;   // Kind being uploaded, 0xFF when idle
+uint16_t bulk_length = 0;
+uint16_t bulk_expected_seq = 0;
+
+uint8_t rx_credits() {
+    uint8_t used;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        used = rx_head - rx_tail;
+    }
+    return (RX_RING_SIZE - 1 - used) / BULK_FRAME_BYTES;
+}
+
+static void bulk_reply(const char* status, const char* seq) {
+    UART_transmit(status);
+    UART_transmit(",");
+    UART_transmit(seq);
+    UART_transmit(",");
+    UART_transmit_u32(rx_credits());
+    UART_transmit_string("");
+}
+
+static uint8_t hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 0xFF;
+}
+
+void handle_bulk_line(char* args) {
+    char* rest = strchr(args, ',');
+    if (rest == NULL) {
+        bulk_reply("NAK", "ARGS");
+        return;
+    }
+    *rest++ = '\0';
+
+    if (strcmp(args, "begin") == 0) {
+        const char* kinds = "DSR";
+        const char* kind = strchr(kinds, rest[0]);
+        char* length = strchr(rest, ',');
+        uint16_t requested = length ? (uint16_t)strtoul(length + 1, NULL, 10) : 0;
+        if (kind == NULL || rest[0] == '\0' || requested == 0 || requested > BULK_AREA_SIZE) {
+            bulk_kind = 0xFF;
+            bulk_reply("NAK", "BEGIN");
+            return;
+        }
+        bulk_kind = kind - kinds;
+        bulk_length = requested;
+        bulk_expected_seq = 0;
+        // Invalidate the area until the upload completes with a good CRC
+        eeprom_update_word(&ee_bulk_header[bulk_kind].length, 0);
+        bulk_reply("ACK", "BEGIN");
+        return;
+    }
+
+    if (bulk_kind == 0xFF) {
+        bulk_reply("NAK", "IDLE");
+        return;
+    }
+
+    if (strcmp(args, "end") == 0) {
+        uint16_t expected = (uint16_t)strtoul(rest, NULL, 16);
+        uint16_t crc = 0xFFFF;
+        for (uint16_t i = 0; i < bulk_length; i++) {
+            crc = _crc_ccitt_update(crc, eeprom_read_byte(&ee_bulk_data[bulk_kind][i]));
+        }
+        if (crc != expected) {
+            bulk_kind = 0xFF;
+            bulk_reply("NAK", "CRC");
+            return;
+        }
+        eeprom_update_word(&ee_bulk_header[bulk_kind].crc, crc);
+        eeprom_update_word(&ee_bulk_header[bulk_kind].length, bulk_length);
+        bulk_kind = 0xFF;
+        bulk_reply("ACK", "END");
+        return;
+    }
+
+    uint16_t seq = (uint16_t)strtoul(args, NULL, 10);
+    if (seq < bulk_expected_seq) {
+        bulk_reply("ACK", args);  // Retransmitted duplicate
+        return;
+    }
+    if (seq > bulk_expected_seq) {
+        char expected[6];
+        utoa(bulk_expected_seq, expected, 10);
+        bulk_reply("NAK", expected);
+        return;
+    }
+
+    uint16_t offset = seq * BULK_CHUNK_BYTES;
+    uint8_t chunk[BULK_CHUNK_BYTES];
+    uint8_t count = 0;
+    while (rest[0] && rest[1] && count < BULK_CHUNK_BYTES) {
+        uint8_t hi = hex_nibble(rest[0]);
+        uint8_t lo = hex_nibble(rest[1]);
+        if (hi == 0xFF || lo == 0xFF || offset + count >= bulk_length) {
+            bulk_reply("NAK", args);
+            return;
+        }
+        chunk[count++] = (hi << 4) | lo;
+        rest += 2;
+    }
+    // The RX interrupt keeps filling the ring while EEPROM writes block here
+    eeprom_update_block(chunk, &ee_bulk_data[bulk_kind][offset], count);
+    bulk_expected_seq++;
+    bulk_reply("ACK", args);
+}
+
+// Device table upload format (bulk kind D): count, then per device
+// name length, name, io (DEVICE_IO packing), group flags
+#define HASH_SEED 5381
+
+static inline uint16_t hash_step(uint16_t hash, uint8_t c) {
+    return (hash << 5) + hash + c;
+}
+
+static uint16_t device_name_hash(const char* name) {
+    uint16_t hash = HASH_SEED;
+    while (*name) {
+        hash = hash_step(hash, *name++);
+    }
+    return hash;
+}
+
+static uint8_t device_name_is(uint8_t i, const char* name) {
+    if (devices[i].name_at == NAME_IN_FLASH) {
+        return strcmp(deviceStates[i].name, name) == 0;
+    }
+    const uint8_t* at = &ee_bulk_data[BULK_DEVICE_TABLE][devices[i].name_at];
+    uint8_t length = eeprom_read_byte(at++);
+    for (uint8_t c = 0; c < length; c++) {
+        if (eeprom_read_byte(at++) != (uint8_t)name[c]) {
+            return 0;
+        }
+    }
+    return name[length] == '\0';
+}
+
+// Hash lookup; only a matching hash costs a full name comparison
+uint8_t find_device(const char* name) {
+    uint16_t hash = device_name_hash(name);
+    uint8_t slot = hash & (DEVICE_HASH_SLOTS - 1);
+    while (device_slots[slot]) {
+        uint8_t i = device_slots[slot] - 1;
+        if (devices[i].hash == hash && device_name_is(i, name)) {
+            return i;
+        }
+        slot = (slot + 1) & (DEVICE_HASH_SLOTS - 1);
+    }
+    return 0xFF;
+}
+
+// PD0/PD1 carry the UART and PB6/PB7 the crystal; PWM only exists on OC1A/OC1B
+static uint8_t device_io_valid(uint8_t io) {
+    uint8_t pin = IO_PIN(io);
+    if (IO_PORT_D(io) ? pin < 2 : pin > 5) {
+        return 0;
+    }
+    if (IO_TYPE(io) == 2) {
+        return !IO_PORT_D(io) && IO_PWM(io) && pin == (IO_PWM(io) == 1 ? PB1 : PB2);
+    }
+    return IO_TYPE(io) <= 1 && IO_PWM(io) == 0;
+}
+
+static uint8_t add_device(uint16_t hash, uint16_t name_at, uint8_t io, uint8_t groups) {
+    uint8_t port = IO_PORT_D(io) ? 1 : 0;
+    uint8_t bit = 1 << IO_PIN(io);
+    if (num_devices >= MAX_DEVICES || !device_io_valid(io) || (output_mask[port] & bit)) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < num_devices; i++) {
+        if (IO_TYPE(io) == 1 && IO_TYPE(devices[i].io) == 1) {
+            return 0;  // One Servo instance
+        }
+    }
+    DeviceSlot* device = &devices[num_devices];
+    device->hash = hash;
+    device->name_at = name_at;
+    device->io = io;
+    device->groups = IO_TYPE(io) == 1 ? 0 : groups;
+    output_mask[port] |= bit;
+
+    uint8_t slot = hash & (DEVICE_HASH_SLOTS - 1);
+    while (device_slots[slot]) {
+        slot = (slot + 1) & (DEVICE_HASH_SLOTS - 1);
+    }
+    device_slots[slot] = ++num_devices;
+    return 1;
+}
+
+static void clear_device_index() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        num_devices = 0;
+        memset(deviceStats, 0, sizeof(deviceStats));
+    }
+    memset(device_slots, 0, sizeof(device_slots));
+    memset(output_mask, 0, sizeof(output_mask));
+}
+
+// Index the uploaded table; returns 0 if it is missing, corrupt or invalid
+static uint8_t load_eeprom_table() {
+    BulkHeader header;
+    const uint8_t* area = ee_bulk_data[BULK_DEVICE_TABLE];
+    eeprom_read_block(&header, &ee_bulk_header[BULK_DEVICE_TABLE], sizeof(header));
+    if (header.length == 0 || header.length > BULK_AREA_SIZE) {
+        return 0;
+    }
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < header.length; i++) {
+        crc = _crc_ccitt_update(crc, eeprom_read_byte(area + i));
+    }
+    if (crc != header.crc) {
+        return 0;
+    }
+
+    uint8_t count = eeprom_read_byte(area);
+    uint16_t at = 1;
+    for (uint8_t d = 0; d < count; d++) {
+        uint8_t length = at < header.length ? eeprom_read_byte(area + at) : 0;
+        if (length == 0 || length >= 32 || at + length + 3 > header.length) {
+            return 0;
+        }
+        uint16_t hash = HASH_SEED;
+        for (uint8_t c = 0; c < length; c++) {
+            uint8_t ch = eeprom_read_byte(area + at + 1 + c);
+            if (ch == '\0' || ch == ',' || ch == '\n') {
+                return 0;
+            }
+            hash = hash_step(hash, ch);
+        }
+        uint8_t io = eeprom_read_byte(area + at + 1 + length);
+        uint8_t groups = eeprom_read_byte(area + at + 2 + length);
+        if (!add_device(hash, at, io, groups)) {
+            return 0;
+        }
+        at += length + 3;
+    }
+    return count > 0;
+}
+
+// Switch to the uploaded device table (or the compiled-in one) without a reflash
+void build_device_index() {
+    // Release the previous table's outputs before configuring the new ones
+    PORTB &= ~output_mask[0];
+    DDRB &= ~output_mask[0];
+    PORTD &= ~output_mask[1];
+    DDRD &= ~output_mask[1];
+    OCR1A = 0;
+    OCR1B = 0;
+    myservo.detach();
+
+    clear_device_index();
+    device_table_source = 'E';
+    if (!load_eeprom_table()) {
+        clear_device_index();
+        device_table_source = 'F';
+        for (uint8_t i = 0; i < NUM_DEFAULT_DEVICES; i++) {
+            add_device(device_name_hash(deviceStates[i].name), NAME_IN_FLASH,
+                       deviceStates[i].io, deviceStates[i].groups);
+        }
+    }
+
+    for (uint8_t g = 0; g < NUM_GROUPS; g++) {
+        DeviceGroup* group = &deviceGroups[g];
+        group->portb_mask = group->portd_mask = group->pwm_mask = 0;
+        for (uint8_t i = 0; i < num_devices; i++) {
+            uint8_t io = devices[i].io;
+            if (!(devices[i].groups & group->members)) {
+                continue;
+            }
+            if (IO_TYPE(io) == 2) {
+                group->pwm_mask |= 1 << (IO_PWM(io) - 1);
+            } else if (IO_PORT_D(io)) {
+                group->portd_mask |= 1 << IO_PIN(io);
+            } else {
+                group->portb_mask |= 1 << IO_PIN(io);
+            }
+        }
+    }
+
+    // All outputs start LOW
+    DDRB |= output_mask[0];
+    DDRD |= output_mask[1];
+    for (uint8_t i = 0; i < num_devices; i++) {
+        if (IO_TYPE(devices[i].io) == 1) {
+            // Arduino numbering: PORTD pins are 0-7, PORTB pins 8-13
+            myservo.attach(IO_PIN(devices[i].io) + (IO_PORT_D(devices[i].io) ? 0 : 8));
+            myservo.write(90);  // Center position
+        }
+    }
+    // Sense channels follow their device wherever it sits in the new table
+    for (uint8_t c = 0; c < SENSE_CHANNELS; c++) {
+        sense_device[c] = find_device(senseChannels[c].device);
+    }
+    log_event(EVT_DEVICE_TABLE, device_table_source == 'E' ? num_devices : 0);
+}
+
+// Active table: TABLE,<E|F>;<name>,<io>,<groups>;... in device index order
+void send_device_table() {
+    UART_transmit("TABLE,");
+    UART_transmit(device_table_source == 'E' ? "E" : "F");
+    for (uint8_t i = 0; i < num_devices; i++) {
+        UART_transmit(";");
+        if (devices[i].name_at == NAME_IN_FLASH) {
+            UART_transmit(deviceStates[i].name);
+        } else {
+            const uint8_t* at = &ee_bulk_data[BULK_DEVICE_TABLE][devices[i].name_at];
+            uint8_t length = eeprom_read_byte(at++);
+            char name[32];
+            eeprom_read_block(name, at, length);
+            name[length] = '\0';
+            UART_transmit(name);
+        }
+        UART_transmit(",");
+        UART_transmit_u32(devices[i].io);
+        UART_transmit(",");
+        UART_transmit_u32(devices[i].groups);
+    }
+    UART_transmit_string("");
+}
+
+static void set_pwm(uint8_t channel, uint8_t value) {
+    if (channel == 1) {
+        OCR1A = value;
+    } else if (channel == 2) {
+        OCR1B = value;
+    }
+}
+
+// Apply on/off (and an optional 0-100 intensity for PWM members) to a whole group
+void apply_group(const char* id, const char* args) {
+    char action[8];
+    const char* comma = strchr(args, ',');
+    uint8_t length = comma ? comma - args : strlen(args);
+    if (length >= sizeof(action)) {
+        length = sizeof(action) - 1;
+    }
+    memcpy(action, args, length);
+    action[length] = '\0';
+
+    for (uint8_t g = 0; g < NUM_GROUPS; g++) {
+        const DeviceGroup* group = &deviceGroups[g];
+        if (strcmp(group->name, id) != 0) {
+            continue;
+        }
+        uint8_t on = strcmp(action, "on") == 0;
+        uint8_t pwm_value = on ? (comma && comma[1] ? (atoi(comma + 1) * 255) / 100 : 255) : 0;
+
+        if (on) {
+            PORTB |= group->portb_mask;
+            PORTD |= group->portd_mask;
+        } else {
+            PORTB &= ~group->portb_mask;
+            PORTD &= ~group->portd_mask;
+        }
+        if (group->pwm_mask & PWM_OCR1A) OCR1A = pwm_value;
+        if (group->pwm_mask & PWM_OCR1B) OCR1B = pwm_value;
+
+        // Usage accounting stays per device
+        for (uint8_t i = 0; i < num_devices; i++) {
+            if (devices[i].groups & group->members) {
+                record_device_change(i, IO_TYPE(devices[i].io) == 2 ? pwm_value : (on ? 255 : 0));
+            }
+        }
+        log_event(EVT_LINE_APPLIED, 0x80 | g);
+        UART_transmit_string("OK");
+        return;
+    }
+    log_event(EVT_UNKNOWN_DEVICE, id[0]);
+}
+
+// Reserved device names that address the firmware itself; returns 1 if handled
+uint8_t handle_control_command(const char* device, const char* action, const char* value) {
+    // Host heartbeat "ping,<seq>": answered, never treated as a device
+    if (strcmp(device, "ping") == 0) {
+        UART_transmit("PONG,");
+        UART_transmit_string(action);
+        return 1;
+    }
+    if (strcmp(device, "caps") == 0) {
+        UART_transmit_string("CAPS,stats,log,uart,baud,bulk,group,table,tasks");
+        return 1;
+    }
+    if (strcmp(device, "table") == 0) {
+        if (strcmp(action, "reload") == 0) {
+            build_device_index();
+            UART_transmit_string("OK");
+        } else {
+            send_device_table();
+        }
+        return 1;
+    }
+    if (strcmp(device, "group") == 0) {
+        apply_group(action, value);
+        return 1;
+    }
+    if (strcmp(device, "stats") == 0) {
+        send_device_stats();
+        return 1;
+    }
+    if (strcmp(device, "log") == 0) {
+        send_event_log(strcmp(action, "eeprom") == 0);
+        return 1;
+    }
+    if (strcmp(device, "uart") == 0) {
+        send_uart_stats();
+        return 1;
+    }
+    if (strcmp(device, "baud") == 0) {
+        request_baud(action);
+        return 1;
+    }
+    if (strcmp(device, "tasks") == 0) {
+        send_task_stats(strcmp(action, "reset") == 0);
+        return 1;
+    }
+    return 0;
+}
+
+void init_pins() {
+    // Outputs, PWM channels and the servo come from the active device table
+    build_device_index();
+}
+
+void update_device_state(const char* device, const char* action, const char* value) {
+    uint8_t i = find_device(device);
+    if (i == 0xFF) {
+        log_event(EVT_UNKNOWN_DEVICE, device[0]);
+        return;
+    }
+    uint8_t io = devices[i].io;
+    volatile uint8_t* port = IO_PORT_D(io) ? &PORTD : &PORTB;
+
+    switch (IO_TYPE(io)) {
+        case 0:  // Digital ON/OFF
+            if (strcmp(action, "on") == 0) {
+                *port |= (1 << IO_PIN(io));
+                record_device_change(i, 255);
+            } else {
+                *port &= ~(1 << IO_PIN(io));
+                record_device_change(i, 0);
+            }
+            break;
+
+        case 1:  // Servo motor
+            if (strcmp(action, "clock") == 0) {
+                int angle = atoi(value);
+                myservo.write(angle);
+                record_device_change(i, angle);
+            } else if (strcmp(action, "anti") == 0) {
+                int angle = atoi(value);
+                myservo.write(180 - angle);
+                record_device_change(i, 180 - angle);
+            }
+            break;
+
+        case 2:  // Intensity control (PWM)
+            if (strcmp(action, "on") == 0) {
+                int intensity = atoi(value);
+                // Map intensity (0-100) to PWM (0-255)
+                int pwm_value = (intensity * 255) / 100;
+                set_pwm(IO_PWM(io), pwm_value);
+                record_device_change(i, pwm_value);
+            } else {
+                set_pwm(IO_PWM(io), 0);
+                record_device_change(i, 0);
+            }
+            break;
+    }
+    log_event(EVT_LINE_APPLIED, i);
+    // Send acknowledgment
+    UART_transmit_string("OK");
 }
 
 void init_pwm() {
@@ -128,6 +1028,13 @@ void parse_csv_data(char* csv_string) {
 
     token = strtok(csv_string, "\n");
     while (token != NULL) {
+        // Bulk chunks are longer than the device/action/value fields
+        if (strncmp(token, "bulk,", 5) == 0) {
+            handle_bulk_line(token + 5);
+            token = strtok(NULL, "\n");
+            continue;
+        }
+
         memset(device, 0, sizeof(device));
         memset(action, 0, sizeof(action));
         memset(value, 0, sizeof(value));
@@ -146,7 +1053,12 @@ void parse_csv_data(char* csv_string) {
             } else {
                 strncpy(action, first_comma + 1, sizeof(action) - 1);
             }
+        } else {
+            // Bare keyword lines such as "stats"
+            strncpy(device, token, sizeof(device) - 1);
+        }
 
+        if (!handle_control_command(device, action, value) && first_comma != NULL) {
             update_device_state(device, action, value);
         }
 
@@ -158,67 +1070,309 @@ void parse_csv_data(char* csv_string) {
 void UART_init(unsigned int ubrr) {
     UBRR0H = (unsigned char)(ubrr>>8);
     UBRR0L = (unsigned char)ubrr;
-    UCSR0B = (1<<RXEN0)|(1<<TXEN0);
+    UCSR0B = (1<<RXEN0)|(1<<TXEN0)|(1<<RXCIE0);
     UCSR0C = (1<<USBS0)|(3<<UCSZ00);
 }
 
-unsigned char UART_receive(void) {
-    while (!(UCSR0A & (1<<RXC0)));
-    return UDR0;
+// Double-speed mode keeps the rate error near 2% up to 115200 at 16 MHz
+void UART_set_baud(uint32_t baud) {
+    uint16_t ubrr = (F_CPU / 8 + baud / 2) / baud - 1;
+    UCSR0A = (1<<U2X0);
+    UBRR0H = (unsigned char)(ubrr>>8);
+    UBRR0L = (unsigned char)ubrr;
+    uart_baud = baud;
 }
 
-void UART_transmit_string(const char* str) {
+ISR(USART_RX_vect) {
+    // Error flags must be read before UDR0
+    uint8_t errors = UCSR0A & ((1<<FE0)|(1<<DOR0)|(1<<UPE0));
+    uint8_t c = UDR0;
+    uint8_t next = rx_head + 1;
+
+    uart_window.rx++;
+    if (errors) {
+        if (errors & (1<<FE0)) uart_window.framing++;
+        if (errors & (1<<DOR0)) uart_window.overrun++;
+        if (errors & (1<<UPE0)) uart_window.parity++;
+        uart_error_flags |= errors;
+    }
+    if (next == rx_tail) {
+        // Ring full: the host ignored its credits
+        uart_window.overrun++;
+        uart_error_flags |= (1<<DOR0);
+        return;
+    }
+    rx_ring[rx_head] = c;
+    rx_head = next;
+    task_ready |= (1 << TASK_PROTOCOL);
+}
+
+// Queue one byte; waits only while the ring is full, so a long report is
+// paced by the wire. Never called with interrupts disabled.
+static void UART_put(char c) {
+    uint8_t next = (tx_head + 1) & (TX_RING_SIZE - 1);
+    while (next == tx_tail);
+    tx_ring[tx_head] = c;
+    tx_head = next;
+    // The ring is not empty now, so the ISR cannot be clearing UDRIE0 meanwhile
+    UCSR0B |= (1<<UDRIE0);
+}
+
+ISR(USART_UDRE_vect) {
+    if (tx_tail == tx_head) {
+        UCSR0B &= ~(1<<UDRIE0);
+        return;
+    }
+    UDR0 = tx_ring[tx_tail];
+    tx_tail = (tx_tail + 1) & (TX_RING_SIZE - 1);
+}
+
+// Transmit without a line terminator, for building up a reply line
+void UART_transmit(const char* str) {
     while (*str) {
-        while (!(UCSR0A & (1<<UDRE0)));
-        UDR0 = *str++;
+        UART_put(*str++);
     }
-    while (!(UCSR0A & (1<<UDRE0)));
-    UDR0 = '\r';
-    while (!(UCSR0A & (1<<UDRE0)));
-    UDR0 = '\n';
 }
 
-int main(void) {
-    // Initialize all subsystems
-    init_pins();
-    init_pwm();
-    UART_init(F_CPU/16/BAUD_RATE - 1);
+void UART_transmit_hex(uint8_t value) {
+    static const char hex[] = "0123456789ABCDEF";
+    char digits[3] = {hex[value >> 4], hex[value & 0x0F], '\0'};
+    UART_transmit(digits);
+}
 
-    volatile char csv_buffer[MAX_CSV_LENGTH];
-    volatile uint8_t buffer_index = 0;
+void UART_transmit_u32(uint32_t value) {
+    char digits[11];
+    ultoa(value, digits, 10);
+    UART_transmit(digits);
+}
 
-    while (1) {
-        char received_char = UART_receive();
-        
-        if (received_char == 'S' && 
-            UART_receive() == 'T' && 
-            UART_receive() == 'A' && 
-            UART_receive() == 'R' && 
-            UART_receive() == 'T') {
-            
-            buffer_index = 0;
-            
-            while (1) {
-                received_char = UART_receive();
-                
-                if (received_char == 'E' && 
-                    UART_receive() == 'N' && 
-                    UART_receive() == 'D') {
-                    
-                    csv_buffer[buffer_index] = '\0';
-                    parse_csv_data((char*)csv_buffer);
-                    UART_transmit_string("CMD_OK");
-                    break;
-                }
-                
-                csv_buffer[buffer_index++] = received_char;
-                
-                if (buffer_index >= MAX_CSV_LENGTH - 1) {
-                    break;
+void UART_transmit_string(const char* str) {
+    UART_transmit(str);
+    UART_put('\r');
+    UART_put('\n');
+}
+
+// Frame receiver: a state machine fed from the receive ring, so a frame can
+// arrive over many protocol task runs without blocking anything else
+enum { FRAME_HUNT = 0, FRAME_BODY = 1 };
+const char FRAME_START[] = "START";
+const char FRAME_END[] = "END";
+
+char csv_buffer[MAX_CSV_LENGTH];
+uint16_t buffer_index = 0;
+uint8_t frame_state = FRAME_HUNT;
+uint8_t frame_match = 0;  // Characters of the current marker matched so far
+
+// Append a payload byte; on overflow tell the host and go back to hunting
+static uint8_t frame_append(char c) {
+    csv_buffer[buffer_index++] = c;
+    if (buffer_index < MAX_CSV_LENGTH - 1) {
+        return 1;
+    }
+    // Tell the host instead of silently dropping the frame
+    log_event(EVT_OVERFLOW, 0);
+    UART_transmit_string("ERR,OVF");
+    frame_state = FRAME_HUNT;
+    frame_match = 0;
+    return 0;
+}
+
+static void frame_complete() {
+    csv_buffer[buffer_index] = '\0';
+    log_event(EVT_FRAME_RX, buffer_index > 0xFF ? 0xFF : buffer_index);
+    // A complete frame proves the current baud rate works
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        baud_probation_ms = 0;
+    }
+    parse_csv_data(csv_buffer);
+    UART_transmit_string("CMD_OK");
+    apply_pending_baud();
+}
+
+// Consume buffered bytes; returns after each complete frame so higher
+// priority work is not held up behind a back-to-back stream of frames
+void protocol_task() {
+    if (uart_error_flags) {
+        uint8_t errors;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            errors = uart_error_flags;
+            uart_error_flags = 0;
+        }
+        log_event(EVT_UART_ERROR, errors);
+    }
+
+    while (rx_head != rx_tail) {
+        char c = rx_ring[rx_tail];
+        rx_tail++;
+
+        if (frame_state == FRAME_HUNT) {
+            if (c == FRAME_START[frame_match]) {
+                if (++frame_match == sizeof(FRAME_START) - 1) {
+                    frame_state = FRAME_BODY;
+                    frame_match = 0;
+                    buffer_index = 0;
                 }
+            } else {
+                frame_match = (c == FRAME_START[0]);
             }
+            continue;
+        }
+
+        if (c == FRAME_END[frame_match]) {
+            if (++frame_match == sizeof(FRAME_END) - 1) {
+                frame_state = FRAME_HUNT;
+                frame_match = 0;
+                frame_complete();
+                break;
+            }
+            continue;
+        }
+        // A partial END marker turned out to be payload
+        uint8_t ok = 1;
+        for (uint8_t m = 0; ok && m < frame_match; m++) {
+            ok = frame_append(FRAME_END[m]);
         }
+        if (!ok) {
+            continue;
+        }
+        frame_match = (c == FRAME_END[0]);
+        if (!frame_match) {
+            frame_append(c);
+        }
+    }
+
+    if (rx_head != rx_tail) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            task_ready |= (1 << TASK_PROTOCOL);
+        }
+    }
+}
+
+// Fold on-time outside the tick interrupt, which has to stay short for the
+// UART at high baud rates; a one second period keeps the products in range
+void fold_task() {
+    for (uint8_t i = 0; i < num_devices; i++) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            fold_on_time(i, tick_ms);
+        }
+    }
+}
+
+// Cooperative run-to-completion scheduler. Periodic tasks become due every
+// period_ms; event tasks (period 0) when an interrupt sets their ready bit.
+// Each pass runs the highest priority due task, so protocol work goes first
+// and the rest fill the gaps. Run times are measured against a per-task
+// budget; a run over budget counts as an overrun, and the longest run seen
+// is kept as the observed worst case.
+typedef struct {
+    const char* name;
+    void (*run)(void);
+    uint16_t period_ms;
+    uint16_t budget_us;
+    uint32_t last_run;
+    uint32_t runs;
+    uint32_t wcet_us;   // Longest run seen
+    uint16_t overruns;
+} Task;
+
+// Protocol replies go out through the TX ring; only reports longer than the
+// ring (LOG, STATS) still wait on the wire, about 1 ms per character at 9600.
+// A mirror run writes at most one 6-byte record (~20 ms)
+Task tasks[NUM_TASKS] = {
+    {"protocol", protocol_task, 0, 20000, 0, 0, 0, 0},
+    {"sense", log_sense_events, 0, 200, 0, 0, 0, 0},
+    {"fold", fold_task, FOLD_PERIOD_MS, 1000, 0, 0, 0, 0},
+    {"mirror", mirror_event_log, 20, 25000, 0, 0, 0, 0}
+};
+
+static uint8_t task_due(uint8_t id, uint32_t now) {
+    if (tasks[id].period_ms) {
+        return now - tasks[id].last_run >= tasks[id].period_ms;
     }
+    return task_ready & (1 << id);
+}
+
+static void run_task(uint8_t id, uint32_t now) {
+    Task* task = &tasks[id];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        task_ready &= ~(1 << id);
+    }
+    task->last_run = now;
+
+    uint32_t started = get_micros();
+    task->run();
+    uint32_t elapsed = get_micros() - started;
+
+    task->runs++;
+    if (elapsed > task->wcet_us) {
+        task->wcet_us = elapsed;
+    }
+    if (elapsed > task->budget_us && task->overruns < 0xFFFF) {
+        task->overruns++;
+    }
+}
+
+// Task report: TASKS;<name>,<runs>,<wcet us>,<budget us>,<overruns>;... in priority order
+void send_task_stats(uint8_t reset) {
+    UART_transmit("TASKS");
+    for (uint8_t id = 0; id < NUM_TASKS; id++) {
+        Task* task = &tasks[id];
+        UART_transmit(";");
+        UART_transmit(task->name);
+        UART_transmit(",");
+        UART_transmit_u32(task->runs);
+        UART_transmit(",");
+        UART_transmit_u32(task->wcet_us);
+        UART_transmit(",");
+        UART_transmit_u32(task->budget_us);
+        UART_transmit(",");
+        UART_transmit_u32(task->overruns);
+    }
+    UART_transmit_string("");
+    if (reset) {
+        for (uint8_t id = 0; id < NUM_TASKS; id++) {
+            tasks[id].runs = 0;
+            tasks[id].wcet_us = 0;
+            tasks[id].overruns = 0;
+        }
+    }
+}
+
+void run_scheduler() {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (1) {
+        uint32_t now = get_ticks();
+        uint8_t id = 0;
+        while (id < NUM_TASKS && !task_due(id, now)) {
+            id++;
+        }
+        if (id < NUM_TASKS) {
+            run_task(id, now);
+            continue;
+        }
+        // Nothing due: idle until the next interrupt (the 1 kHz tick at the
+        // latest). sei only takes effect after sleep_cpu, so a ready bit set
+        // after the check still wakes us.
+        cli();
+        if (!task_ready) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+    }
+}
+
+int main(void) {
+    // Initialize all subsystems
+    init_pins();
+    init_pwm();
+    init_tick();
+    init_adc();
+    UART_init(F_CPU/16/BAUD_RATE - 1);
+    sei();
 
+    run_scheduler();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+import re
+from typing import Any, Dict, List, Optional
+
+from device_names import AmbiguousDeviceName, DeviceNameResolver, normalize
+
+VERBS = {"turn", "switch", "set", "dim", "put", "please"}
+STATES = {"on", "off"}
+# Anything involving timing, conditions, negation, questions or the servo is
+# left to the LLM
+DECLINE_WORDS = {
+    "after", "in", "minute", "minutes", "second", "seconds", "hour", "hours", "later",
+    "tomorrow", "tonight", "before", "until", "when", "if", "unless", "then", "every",
+    "except", "but", "not", "don", "dont", "what", "why", "how", "is", "are",
+    "rotate", "degree", "degrees", "servo"
+}
+GROUP_WORDS = {
+    "lights": "lights", "all lights": "lights", "every light": "lights",
+    "all": "all", "everything": "all", "all devices": "all"
+}
+
+
+def command_key(command: str) -> str:
+    """Case, punctuation and spacing-insensitive form of a command, for comparing and collapsing"""
+    return " ".join(re.findall(r"[a-z0-9%]+", command.lower()))
+
+
+class FastPathParser:
+    """
+    Rule-based parser for plain switching commands, answering in the LLM's
+    output format without a model call.
+
+    Understands "turn on/off <device or group>", "<target> on/off" and
+    "set/dim <light> to <n>%", joined with "and" (a clause without its own
+    action inherits the previous one). Anything else, including every name the
+    resolver cannot map to exactly one device, returns None so the caller falls
+    back to the LLM; it never guesses.
+    """
+
+    def __init__(self, device_states: Dict[str, Any], groups: Dict[str, List[str]],
+                 resolver: Optional[DeviceNameResolver] = None):
+        self.device_states = device_states
+        self.groups = groups
+        self.resolver = resolver or DeviceNameResolver(device_states)
+
+    def parse(self, text: str) -> Optional[Dict[str, Any]]:
+        words = normalize(text.replace("%", " percent ")).split()
+        if not words or DECLINE_WORDS.intersection(words):
+            return None
+
+        clauses, current = [], []
+        for word in words:
+            if word == "and":
+                clauses.append(current)
+                current = []
+            else:
+                current.append(word)
+        clauses.append(current)
+
+        states, intensity = {}, {}
+        action = None
+        for clause in clauses:
+            parsed = self._clause(clause, action)
+            if parsed is None:
+                return None
+            targets, action = parsed
+            state, level = action
+            for device in targets:
+                states[device] = state
+                if level is not None:
+                    intensity[device] = level
+        return {
+            "device_states": states,
+            "light_intensity": intensity,
+            "chatbot_message": "Done",
+            "delay_seconds": 0
+        }
+
+    def _clause(self, words, inherited):
+        """(devices, (state, level)) for one clause, or None if it is not understood"""
+        words = [w for w in words if w not in VERBS]
+        state = level = None
+        if len(words) >= 2 and words[-1] == "percent" and words[-2].isdigit():
+            level = int(words[-2])
+            words = words[:-2]
+            if words and words[-1] in ("to", "at"):
+                words = words[:-1]
+            if level > 100:
+                return None
+        if words and words[0] in STATES:
+            state, words = words[0], words[1:]
+        elif words and words[-1] in STATES:
+            state, words = words[-1], words[:-1]
+
+        if level is not None:
+            # "turn off the light to 40%" contradicts itself
+            if state == "off":
+                return None
+            state = "on" if level > 0 else "off"
+        if state is None:
+            if inherited is None:
+                return None
+            state, level = inherited
+
+        targets = self._targets(" ".join(words))
+        if not targets:
+            return None
+        if level is not None and not all(self._dimmable(d) for d in targets):
+            return None
+        return targets, (state, level)
+
+    def _targets(self, name: str) -> Optional[List[str]]:
+        if not name:
+            return None
+        if name in GROUP_WORDS:
+            return [d for d in self.groups.get(GROUP_WORDS[name], []) if d in self.device_states]
+        try:
+            device = self.resolver.resolve(name)
+        except AmbiguousDeviceName:
+            return None
+        if device is None or self._is_servo(device):
+            return None
+        return [device]
+
+    def _dimmable(self, device: str) -> bool:
+        state = self.device_states.get(device)
+        return isinstance(state, dict) and "intensity" in state
+
+    def _is_servo(self, device: str) -> bool:
+        state = self.device_states.get(device)
+        return isinstance(state, dict) and "direction" in state
@@ -0,0 +1,70 @@
+from typing import Any, Dict
+
+
+class FramePacer:
+    """
+    Learns how long a board takes to process a frame and spaces frames just above it.
+
+    Each frame is timed from write to its CMD_OK (which follows the per-line
+    "on"/"off" or "OK" echoes on every firmware build). The estimated wire time
+    is subtracted to get the board's own processing time, tracked as an EWMA.
+    The guard gap before the next frame is a safety margin on top of that
+    estimate; a missing CMD_OK doubles the gap (capped at the legacy fixed
+    0.3 s) and successes halve it back.
+    """
+
+    LEGACY_GAP = 0.3
+
+    def __init__(self, baud_rate: int = 9600, margin: float = 0.5, min_gap: float = 0.005,
+                 smoothing: float = 0.2):
+        self.baud_rate = baud_rate
+        self.margin = margin
+        self.min_gap = min_gap
+        self.smoothing = smoothing
+        self.reset()
+
+    def reset(self):
+        """Forget the learned timing, e.g. after switching to another board"""
+        self.processing = None
+        self.backoff = 1.0
+        self.frames = 0
+        self.timeouts = 0
+
+    def wire_time(self, length: int) -> float:
+        """Seconds to clock length bytes out at 10 bits per character"""
+        return length * 10 / self.baud_rate
+
+    def ack_timeout(self, length: int) -> float:
+        """How long to wait for CMD_OK before treating the frame as unacknowledged"""
+        expected = self.wire_time(length) + (self.processing if self.processing is not None else self.LEGACY_GAP)
+        return min(max(expected * 4, 0.2), 2.0)
+
+    def observe(self, elapsed: float, length: int, acked: bool):
+        """Record one frame: elapsed seconds from write to CMD_OK and the payload length"""
+        self.frames += 1
+        if not acked:
+            self.timeouts += 1
+            self.backoff = min(self.backoff * 2, self.LEGACY_GAP / self.min_gap)
+            return
+        # START/END markers and newline add 9 bytes; CMD_OK\r\n comes back
+        processing = max(elapsed - self.wire_time(length + 9) - self.wire_time(8), 0.0)
+        if self.processing is None:
+            self.processing = processing
+        else:
+            self.processing += self.smoothing * (processing - self.processing)
+        self.backoff = max(self.backoff / 2, 1.0)
+
+    def gap(self) -> float:
+        """Guard time to wait after CMD_OK before writing the next frame"""
+        if self.processing is None:
+            return self.LEGACY_GAP
+        return min(max(self.processing * self.margin, self.min_gap) * self.backoff, self.LEGACY_GAP)
+
+    def snapshot(self) -> Dict[str, Any]:
+        return {
+            "processing_ms": round(self.processing * 1000, 2) if self.processing is not None else None,
+            "gap_ms": round(self.gap() * 1000, 2),
+            "backoff": self.backoff,
+            "frames": self.frames,
+            "timeouts": self.timeouts,
+        }
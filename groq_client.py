@@ -1,32 +1,76 @@
-from langchain_community.vectorstores import FAISS
 from langchain.llms.base import LLM
 from groq import Groq
-from typing import Any, List, Optional, Dict
+from typing import Any, Callable, List, Optional, Dict
 from pydantic import Field, BaseModel
 import os
-from langchain.chains import LLMChain
-from langchain.prompts import PromptTemplate
-from langchain.output_parsers import StructuredOutputParser, ResponseSchema
-from langchain_community.llms import Ollama
+import time
 
 
 class GroqLLM(LLM, BaseModel):
+    """
+    Groq chat completion as a Langchain LLM.
+
+    With cascade_models set, each prompt goes to those (smaller, faster) models
+    first, in order; the first answer that passes validator is returned. Only
+    when none passes does the prompt reach model_name, and each such fallback
+    counts as an escalation in metrics.
+    """
     groq_api_key: str = Field(..., description="Groq API Key")
     model_name: str = Field(default="llama-3.3-70b-versatile", description="Model name to use")
+    cascade_models: List[str] = Field(default_factory=list, description="Faster models tried before model_name")
+    validator: Optional[Callable[[str], bool]] = Field(default=None, description="Accepts or rejects a cascade answer")
+    metrics: Dict[str, Any] = Field(default_factory=dict)
     client: Optional[Any] = None
 
     def __init__(self, **data):
         super().__init__(**data)
         self.client = Groq(api_key=self.groq_api_key)
+        self.metrics.update({
+            "calls": 0,
+            "escalations": 0,
+            "escalation_rate": 0.0,
+            "large_model_latency_ms": None,  # EWMA of full-model calls
+            "latency_saved_ms": 0.0
+        })
     
     @property
     def _llm_type(self) -> str:
         return "groq"
 
     def _call(self, prompt: str, stop: Optional[List[str]] = None, **kwargs: Any) -> str:
+        if not self.cascade_models or self.validator is None:
+            return self._complete(self.model_name, prompt, **kwargs)
+
+        metrics = self.metrics
+        metrics["calls"] += 1
+        started = time.monotonic()
+        for model in self.cascade_models:
+            try:
+                text = self._complete(model, prompt, **kwargs)
+            except Exception as e:
+                print(f"Cascade model {model} failed: {e}")
+                continue
+            if self.validator(text):
+                # Saving is measured against the running average of the full model
+                if metrics["large_model_latency_ms"] is not None:
+                    elapsed_ms = (time.monotonic() - started) * 1000
+                    metrics["latency_saved_ms"] += max(metrics["large_model_latency_ms"] - elapsed_ms, 0.0)
+                metrics["escalation_rate"] = metrics["escalations"] / metrics["calls"]
+                return text
+
+        metrics["escalations"] += 1
+        metrics["escalation_rate"] = metrics["escalations"] / metrics["calls"]
+        large_started = time.monotonic()
+        text = self._complete(self.model_name, prompt, **kwargs)
+        elapsed_ms = (time.monotonic() - large_started) * 1000
+        average = metrics["large_model_latency_ms"]
+        metrics["large_model_latency_ms"] = elapsed_ms if average is None else average + 0.2 * (elapsed_ms - average)
+        return text
+
+    def _complete(self, model: str, prompt: str, **kwargs: Any) -> str:
         completion = self.client.chat.completions.create(
             messages=[{"role": "user", "content": prompt}],
-            model=self.model_name,
+            model=model,
             **kwargs
         )
         return completion.choices[0].message.content
@@ -35,9 +79,12 @@ class GroqLLM(LLM, BaseModel):
     def _identifying_params(self) -> Dict[str, Any]:
         """Get the identifying parameters."""
         return {
-            "model_name": self.model_name
+            "model_name": self.model_name,
+            "cascade_models": self.cascade_models
         }
         
+# Local backend; import it only where it is used:
+# from langchain_community.llms import Ollama
 # llm = Ollama(
 #     model="qwen2.5-coder:3b",  # Your local model name
 #     base_url="http://localhost:11434"  # Default Ollama API endpoint
@@ -0,0 +1,125 @@
+import heapq
+import itertools
+import logging
+import threading
+import time
+import tracemalloc
+from typing import Any, Callable, Dict, Optional
+
+
+class CommandScheduler:
+    """
+    Single timer thread shared by every home for delayed commands, replacing
+    one threading.Timer thread per scheduled command
+    """
+
+    def __init__(self):
+        self._queue = []
+        self._counter = itertools.count()
+        self._cond = threading.Condition()
+        self._stopped = False
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def schedule(self, delay: float, fn: Callable, *args):
+        with self._cond:
+            heapq.heappush(self._queue, (time.monotonic() + delay, next(self._counter), fn, args))
+            self._cond.notify()
+
+    def __len__(self) -> int:
+        return len(self._queue)
+
+    def stop(self):
+        with self._cond:
+            self._stopped = True
+            self._cond.notify()
+
+    def _run(self):
+        while True:
+            with self._cond:
+                while not self._stopped and (not self._queue or self._queue[0][0] > time.monotonic()):
+                    timeout = self._queue[0][0] - time.monotonic() if self._queue else None
+                    self._cond.wait(timeout)
+                if self._stopped:
+                    return
+                _, _, fn, args = heapq.heappop(self._queue)
+            try:
+                fn(*args)
+            except Exception as e:
+                logging.error(f"Scheduled command failed: {e}")
+
+
+class HomeRegistry:
+    """
+    Controllers for many homes in one process, keyed by home ID.
+
+    Each home owns its device state, outbox and serial link; the factory is expected
+    to hand every controller the same LLM context, and delayed commands from all
+    homes share one CommandScheduler. start_services(home_id, controller), if
+    given, starts the per-home extras such as the local API socket. The memory
+    and thread cost of each home is measured when it is added, as the change in
+    all traced bytes and live threads across the factory and start_services;
+    anything else the process does meanwhile is charged to the home too.
+    """
+
+    def __init__(self, factory: Callable[..., Any], default_home_id: str = "default",
+                 start_services: Optional[Callable[[str, Any], None]] = None):
+        self.factory = factory
+        self.start_services = start_services
+        self.default_home_id = default_home_id
+        self.scheduler = CommandScheduler()
+        self.homes: Dict[str, Any] = {}
+        self.home_overhead: Dict[str, Dict[str, int]] = {}
+        self._lock = threading.Lock()
+
+    def add_home(self, home_id: str, **controller_kwargs):
+        """Create and register a home, recording the bytes and threads it added"""
+        with self._lock:
+            if home_id in self.homes:
+                raise ValueError(f"Home {home_id} already registered")
+            threads_before = set(threading.enumerate())
+            was_tracing = tracemalloc.is_tracing()
+            if not was_tracing:
+                tracemalloc.start()
+            memory_before = self._traced_snapshot()
+            try:
+                controller = self.factory(**controller_kwargs)
+                if self.start_services is not None:
+                    self.start_services(home_id, controller)
+            finally:
+                memory_after = self._traced_snapshot()
+                if not was_tracing:
+                    tracemalloc.stop()
+            self.homes[home_id] = controller
+            self.home_overhead[home_id] = {
+                "bytes": sum(stat.size_diff for stat in memory_after.compare_to(memory_before, "filename")),
+                "threads": len(set(threading.enumerate()) - threads_before)
+            }
+            print(f"Registered home {home_id}: {self.home_overhead[home_id]}")
+            return controller
+
+    @staticmethod
+    def _traced_snapshot() -> tracemalloc.Snapshot:
+        """Every live traced allocation, less tracemalloc's own bookkeeping"""
+        return tracemalloc.take_snapshot().filter_traces(
+            [tracemalloc.Filter(False, tracemalloc.__file__)])
+
+    def get(self, home_id: Optional[str] = None):
+        return self.homes.get(home_id or self.default_home_id)
+
+    def overhead(self) -> Dict[str, Any]:
+        """Per-home cost summary for capacity planning"""
+        count = len(self.home_overhead)
+        total_bytes = sum(h["bytes"] for h in self.home_overhead.values())
+        total_threads = sum(h["threads"] for h in self.home_overhead.values())
+        return {
+            "homes": count,
+            "process_threads": threading.active_count(),
+            "mean_bytes_per_home": total_bytes // count if count else 0,
+            "mean_threads_per_home": total_threads / count if count else 0,
+            "per_home": self.home_overhead
+        }
+
+    def close(self):
+        self.scheduler.stop()
+        for controller in self.homes.values():
+            controller.close()
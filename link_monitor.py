@@ -0,0 +1,132 @@
+import logging
+import threading
+import time
+from typing import Any, Dict
+
+import serial
+
+
+class LinkMonitor:
+    """
+    Heartbeat supervisor for the controller's serial link.
+
+    Every interval seconds a tiny "ping,<seq>" frame is sent; both firmware builds
+    answer any frame with CMD_OK (evr_file_V2 treats it as a control command, so
+    it is not logged as an unknown device). An ack missing after deadline seconds
+    is a miss. After a miss the board is probed again straight away instead of
+    a full interval later; misses_before_failover consecutive misses mark it as
+    hung and trigger controller.failover(), so one late ack (a slow EEPROM
+    write, a busy host) never resets a healthy board while a hung one is still
+    detected misses_before_failover * deadline after its first missed ping
+    (0.9 s with the defaults). With a baud adapter, a lower baud rate is tried
+    before failing over. Detection time, measured from that first missed ping,
+    and failover time are kept in metrics.
+    """
+
+    def __init__(self, controller, interval: float = 1.0, deadline: float = 0.3, quality=None,
+                 misses_before_failover: int = 3):
+        self.controller = controller
+        self.interval = interval
+        self.deadline = deadline
+        self.misses_before_failover = max(1, misses_before_failover)
+        self._misses = 0  # Consecutive
+        self._first_miss = None  # When the first ping of the current run of misses was sent
+        self.quality = quality  # Optional BaudAdapter, evaluated while the link is healthy
+        self._seq = 0
+        self._stop = threading.Event()
+        self._thread = None
+        self.metrics: Dict[str, Any] = {
+            "heartbeats_sent": 0,
+            "heartbeats_missed": 0,
+            "failovers": 0,
+            "failover_errors": 0,
+            "last_rtt_ms": None,
+            "last_detection_ms": None,
+            "last_failover_ms": None,
+            "last_ack_age_ms": None,
+        }
+        self._last_ack = None
+
+    def start(self):
+        if self._thread is None:
+            self._thread = threading.Thread(target=self._run, daemon=True)
+            self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+
+    def snapshot(self) -> Dict[str, Any]:
+        metrics = dict(self.metrics)
+        if self._last_ack is not None:
+            metrics["last_ack_age_ms"] = round((time.monotonic() - self._last_ack) * 1000, 1)
+        metrics["active_port"] = self.controller.serial_port
+        return metrics
+
+    def _run(self):
+        while not self._stop.wait(0 if self._misses else self.interval):
+            try:
+                self.check()
+            except Exception as e:
+                logging.error(f"Link monitor error: {e}")
+
+    def check(self) -> bool:
+        """Send one heartbeat and fail over if it is not acknowledged in time"""
+        controller = self.controller
+        sent = time.monotonic()
+        if controller.ser is None and not controller._open_serial():
+            return self._on_missed(sent)
+
+        self._seq = (self._seq + 1) % 1000
+        self.metrics["heartbeats_sent"] += 1
+        try:
+            acked = controller._transact(f"ping,{self._seq}", self.deadline)
+        except (serial.SerialException, OSError):
+            acked = False
+        if not acked:
+            return self._on_missed(sent)
+
+        self._last_ack = time.monotonic()
+        self._misses = 0
+        self._first_miss = None
+        self.metrics["last_rtt_ms"] = round((self._last_ack - sent) * 1000, 1)
+        controller._confirm_delivered()
+        # The standby is pre-opened only once the active board answers, so its
+        # 2 s reset never delays bringing up the primary
+        controller._warm_standby()
+        if self.quality:
+            self.quality.maybe_evaluate()
+        return True
+
+    def _on_missed(self, sent: float) -> bool:
+        detected = time.monotonic()
+        self.metrics["heartbeats_missed"] += 1
+        self._misses += 1
+        if self._first_miss is None:
+            self._first_miss = sent
+        if self._misses < self.misses_before_failover:
+            return False
+        self._misses = 0
+        self.metrics["last_detection_ms"] = round((detected - self._first_miss) * 1000, 1)
+        self._first_miss = None
+        # A link that degraded at a high baud rate would fail over at that same
+        # rate again; a slower rate that answers is a cheaper cure
+        if self.quality and self.controller.ser is not None:
+            try:
+                if self.quality.step_down():
+                    self._last_ack = time.monotonic()
+                    print(f"Heartbeats missed on {self.controller.serial_port}, stepped the baud rate down")
+                    return False
+            except (serial.SerialException, OSError) as e:
+                logging.error(f"Baud step down failed: {e}")
+        if self._last_ack is not None:
+            print(f"{self.misses_before_failover} heartbeats missed on {self.controller.serial_port}, failing over")
+
+        if self.controller.failover():
+            self.metrics["failovers"] += 1
+            self.metrics["last_failover_ms"] = round((time.monotonic() - detected) * 1000, 1)
+            self._last_ack = time.monotonic()
+            print(f"Failed over to {self.controller.serial_port} in {self.metrics['last_failover_ms']} ms")
+        else:
+            self.metrics["failover_errors"] += 1
+            self._last_ack = None
+        return False
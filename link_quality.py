@@ -0,0 +1,121 @@
+import logging
+import time
+from typing import Any, Dict
+
+import serial
+
+# Rates the firmware accepts in "baud,<rate>"; it reverts on its own if no
+# frame arrives within its probation window after a change
+BAUD_LADDER = [9600, 19200, 38400, 57600, 115200]
+FIRMWARE_BAUD_PROBATION = 3.0
+
+
+class BaudAdapter:
+    """
+    Runs the serial link at the highest rate the cable sustains.
+
+    Every window seconds, or as soon as spike_errors host receive errors pile up,
+    the firmware's UART error counters ("uart" query) and the host's own receive
+    errors are sampled. Errors step the rate down one rung of BAUD_LADDER;
+    clean_windows consecutive clean windows step it back up, never beyond
+    max_baud. The link monitor also asks for a step down when heartbeats stop
+    arriving, before it fails over. Each change is confirmed with a heartbeat at
+    the new rate and rolled back on both ends when that fails.
+    """
+
+    def __init__(self, controller, window: float = 10.0, max_error_rate: float = 0.001,
+                 clean_windows: int = 6, max_baud: int = 115200, spike_errors: int = 8):
+        self.controller = controller
+        self.window = window
+        self.max_error_rate = max_error_rate
+        self.clean_windows = clean_windows
+        self.max_baud = max_baud
+        self.spike_errors = spike_errors
+        self._clean = 0
+        self._last_evaluated = time.monotonic()
+        self._last_host_errors = 0
+        self.metrics: Dict[str, Any] = {
+            "baud": None,
+            "step_downs": 0,
+            "step_ups": 0,
+            "failed_switches": 0,
+            "last_window": None,
+        }
+
+    def maybe_evaluate(self):
+        spike = self.controller.rx_errors - self._last_host_errors >= self.spike_errors
+        if spike or time.monotonic() - self._last_evaluated >= self.window:
+            self._last_evaluated = time.monotonic()
+            try:
+                self.evaluate()
+            except (serial.SerialException, OSError) as e:
+                logging.error(f"Link quality check failed: {e}")
+
+    def evaluate(self):
+        controller = self.controller
+        if controller.ser is None:
+            return
+        current = controller.ser.baudrate
+        self.metrics["baud"] = current
+        # Raw TCP bridges run the board's port at a rate fixed on the bridge
+        if not getattr(controller.ser, "supports_baud_change", True):
+            return
+        host_errors = controller.rx_errors - self._last_host_errors
+        self._last_host_errors = controller.rx_errors
+
+        line = controller._query("uart", "UART,")
+        if line is None:
+            received, firmware_errors = 0, 1
+        else:
+            received, framing, overrun, parity = (int(x) for x in line.split(",")[2:6])
+            firmware_errors = framing + overrun + parity
+        errors = firmware_errors + host_errors
+        self.metrics["last_window"] = {"bytes": received, "firmware_errors": firmware_errors, "host_errors": host_errors}
+
+        if errors and errors > self.max_error_rate * max(received, 1):
+            self.step_down()
+        elif not errors:
+            self._clean += 1
+            higher = [b for b in BAUD_LADDER if current < b <= self.max_baud]
+            if higher and self._clean >= self.clean_windows:
+                self._clean = 0
+                if self._switch(higher[0]):
+                    self.metrics["step_ups"] += 1
+
+    def step_down(self) -> bool:
+        """Drop one rung; False at the lowest rate, on a fixed-rate bridge or if the switch fails"""
+        controller = self.controller
+        self._clean = 0
+        if controller.ser is None or not getattr(controller.ser, "supports_baud_change", True):
+            return False
+        lower = [b for b in BAUD_LADDER if b < controller.ser.baudrate]
+        if not lower or not self._switch(lower[-1]):
+            return False
+        self.metrics["step_downs"] += 1
+        return True
+
+    def _switch(self, baud: int) -> bool:
+        controller = self.controller
+        # Hold the link for the handshake so no frame goes out at a mismatched rate
+        with controller._serial_lock:
+            old = controller.ser.baudrate
+            if not controller._transact(f"baud,{baud}", controller.ack_timeout):
+                self.metrics["failed_switches"] += 1
+                return False
+
+            controller.ser.baudrate = baud
+            time.sleep(0.01)
+            if controller._transact("ping,0", controller.ack_timeout):
+                self.metrics["baud"] = baud
+                print(f"Serial link switched from {old} to {baud} baud")
+                return True
+
+            # The firmware falls back after its probation window. Frames sent
+            # meanwhile at the old rate are garbage to it and cannot confirm the
+            # new one; the outbox holds off until then, without the lock held
+            controller.ser.baudrate = old
+            controller._link_paused_until = time.monotonic() + FIRMWARE_BAUD_PROBATION + 0.2
+        time.sleep(FIRMWARE_BAUD_PROBATION + 0.2)
+        self.metrics["failed_switches"] += 1
+        logging.error(f"Baud change to {baud} failed, staying at {old}")
+        return False
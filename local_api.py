@@ -0,0 +1,350 @@
+"""
+Binary control interface on a Unix domain socket for local automation clients.
+
+Every message is a 2-byte big-endian length followed by that many payload bytes;
+the first payload byte is the opcode. Devices are addressed by their index in the
+manifest (the controller's device order at server start) and encoded as 5-byte
+records: index (u8), on (u8), direction (u8: 0 none, 1 clock, 2 anti), value (i16,
+intensity or degrees).
+
+    0x01 GET_STATE                  -> 0x81 version(u32) record*
+    0x02 SET record*                -> 0x82 version(u32) changed record*
+    0x03 SUBSCRIBE boot(u32) since(u32)
+                                    -> 0x83 version(u32) record* (changes since),
+                                       then 0x84 version(u32) record* on every change
+    0x04 MANIFEST                   -> 0x85 boot(u32) (len(u8) utf-8 name)*
+    any error                       -> 0xFF code(u8)
+
+Versions restart at 0 when the controller restarts, so SUBSCRIBE names the boot
+its version came from (the boot_id of HTTP state tokens, as a u32); a version
+from another boot gets every device, never a wrongly empty delta. Events made
+while the SUBSCRIBE reply is built are queued and follow it, so none is lost;
+one already in the reply may arrive again.
+
+SET records are validated like an HTTP PATCH (intensity 0-100, degrees 0-180);
+a SET with any invalid record changes nothing. Each subscriber has a bounded
+event queue drained by its own writer thread; one that falls further behind is
+disconnected rather than stalling state changes for everyone.
+
+Each home gets its own socket: the default home at DEFAULT_SOCKET_PATH, every
+other home at home_socket_path(home_id).
+"""
+
+import os
+import queue
+import re
+import socket
+import socketserver
+import struct
+import sys
+import threading
+import time
+from typing import Any, Dict, List, Optional, Tuple
+
+OP_GET_STATE = 0x01
+OP_SET = 0x02
+OP_SUBSCRIBE = 0x03
+OP_MANIFEST = 0x04
+OP_STATE = 0x81
+OP_SET_OK = 0x82
+OP_SUBSCRIBED = 0x83
+OP_EVENT = 0x84
+OP_MANIFEST_OK = 0x85
+OP_ERROR = 0xFF
+
+ERR_BAD_OPCODE = 1
+ERR_BAD_RECORD = 2
+ERR_UNKNOWN_DEVICE = 3
+ERR_INVALID_STATE = 4
+
+LENGTH = struct.Struct(">H")
+VERSION = struct.Struct(">I")
+TOKEN = struct.Struct(">II")  # boot, version
+RECORD = struct.Struct(">BBBh")
+DIRECTIONS = ["none", "clock", "anti"]
+
+DEFAULT_SOCKET_PATH = "/tmp/smart_home.sock"
+SUBSCRIBER_QUEUE = 64  # Events buffered per subscriber before it is dropped as too slow
+
+
+def home_socket_path(home_id: str) -> str:
+    """Socket path for a home other than the default one"""
+    return f"/tmp/smart_home.{re.sub(r'[^A-Za-z0-9_-]', '_', home_id)}.sock"
+
+
+def encode_state(index: int, state: Any) -> bytes:
+    """Pack one device state in the controller's dict/str form into a record"""
+    if isinstance(state, dict):
+        if "direction" in state:
+            direction = DIRECTIONS.index(state.get("direction", "none")) if state.get("direction") in DIRECTIONS else 0
+            return RECORD.pack(index, 0, direction, int(state.get("degrees", 0)))
+        return RECORD.pack(index, state.get("state") == "on", 0, int(state.get("intensity", 0)))
+    return RECORD.pack(index, state == "on", 0, 0)
+
+
+def decode_state(current: Any, on: int, direction: int, value: int) -> Any:
+    """Unpack a record into the same shape as the device's current state"""
+    if isinstance(current, dict):
+        if "direction" in current:
+            if direction >= len(DIRECTIONS):
+                raise ValueError("bad direction")
+            return {"direction": DIRECTIONS[direction], "degrees": value}
+        return {"state": "on" if on else "off", "intensity": value}
+    return "on" if on else "off"
+
+
+def read_message(sock: socket.socket) -> bytes:
+    header = _read_exact(sock, LENGTH.size)
+    return _read_exact(sock, LENGTH.unpack(header)[0])
+
+
+def write_message(sock: socket.socket, payload: bytes):
+    sock.sendall(LENGTH.pack(len(payload)) + payload)
+
+
+def _read_exact(sock: socket.socket, size: int) -> bytes:
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("peer closed")
+        data += chunk
+    return data
+
+
+class _LocalApiHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        api = self.server.api
+        self._send_lock = threading.Lock()
+        self._events = queue.Queue(maxsize=SUBSCRIBER_QUEUE)
+        subscribed = False
+        try:
+            while True:
+                payload = read_message(self.request)
+                if not payload:
+                    continue
+                if payload[0] == OP_SUBSCRIBE and not subscribed:
+                    # Buffer events before the snapshot is built, send the
+                    # snapshot, and only then let the buffered events follow it
+                    api.subscribe(self)
+                    reply = api.dispatch(payload[0], payload[1:])
+                    self.send(reply)
+                    if reply[0] != OP_SUBSCRIBED:
+                        api.unsubscribe(self)
+                        continue
+                    subscribed = True
+                    threading.Thread(target=self._write_events, daemon=True).start()
+                    continue
+                self.send(api.dispatch(payload[0], payload[1:]))
+        except (ConnectionError, OSError):
+            pass
+        finally:
+            if subscribed:
+                api.unsubscribe(self)
+                try:
+                    self._events.put_nowait(None)
+                except queue.Full:
+                    pass  # The writer fails on the closed socket instead
+
+    def send(self, payload: bytes):
+        with self._send_lock:
+            write_message(self.request, payload)
+
+    def push(self, event: bytes) -> bool:
+        """Queue an event for the writer thread; False if this subscriber is too far behind"""
+        try:
+            self._events.put_nowait(event)
+            return True
+        except queue.Full:
+            return False
+
+    def drop(self):
+        """Disconnect; the handler and writer threads both see the socket fail"""
+        try:
+            self.request.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+
+    def _write_events(self):
+        while True:
+            event = self._events.get()
+            if event is None:
+                return
+            try:
+                self.send(event)
+            except OSError:
+                return
+
+
+class _UnixServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+class LocalApiServer:
+    """
+    Serves the binary protocol above for one controller, bypassing Flask entirely
+    """
+
+    def __init__(self, controller, path: str = DEFAULT_SOCKET_PATH):
+        self.controller = controller
+        self.path = path
+        self.manifest: List[str] = list(controller.device_states.keys())
+        self._index = {name: i for i, name in enumerate(self.manifest)}
+        self._subscribers = set()
+        self._subscribers_lock = threading.Lock()
+        self._server = None
+
+    def start(self):
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        self._server = _UnixServer(self.path, _LocalApiHandler)
+        self._server.api = self
+        self.controller.add_state_listener(self._on_change)
+        threading.Thread(target=self._server.serve_forever, daemon=True).start()
+        print(f"Local binary API listening on {self.path}")
+
+    def stop(self):
+        if self._server:
+            self._server.shutdown()
+            self._server.server_close()
+            self._server = None
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+
+    def dispatch(self, opcode: int, body: bytes) -> bytes:
+        if opcode == OP_GET_STATE:
+            return self._state_message(OP_STATE, self.controller.state_version, self.manifest)
+        if opcode == OP_SET:
+            return self._set(body)
+        if opcode == OP_SUBSCRIBE:
+            version = self.controller.state_version
+            since = None
+            if len(body) >= TOKEN.size:
+                boot, since = TOKEN.unpack(body[:TOKEN.size])
+                since = self.controller.token_version(f"{boot:08x}-{since}")
+            changed = self.manifest if since is None else self.controller.changes_since(since)
+            return self._state_message(OP_SUBSCRIBED, version, changed)
+        if opcode == OP_MANIFEST:
+            names = b"".join(bytes([len(n.encode())]) + n.encode() for n in self.manifest)
+            return bytes([OP_MANIFEST_OK]) + VERSION.pack(int(self.controller.boot_id, 16)) + names
+        return bytes([OP_ERROR, ERR_BAD_OPCODE])
+
+    def subscribe(self, handler):
+        with self._subscribers_lock:
+            self._subscribers.add(handler)
+
+    def unsubscribe(self, handler):
+        with self._subscribers_lock:
+            self._subscribers.discard(handler)
+
+    def _set(self, body: bytes) -> bytes:
+        if len(body) % RECORD.size:
+            return bytes([OP_ERROR, ERR_BAD_RECORD])
+        patch = {}
+        for index, on, direction, value in RECORD.iter_unpack(body):
+            if index >= len(self.manifest):
+                return bytes([OP_ERROR, ERR_UNKNOWN_DEVICE])
+            dev = self.manifest[index]
+            try:
+                patch[dev] = decode_state(self.controller.device_states.get(dev), on, direction, value)
+            except ValueError:
+                return bytes([OP_ERROR, ERR_BAD_RECORD])
+        try:
+            # Same validation as PATCH /command: intensity 0-100, degrees 0-180
+            version, changed = self.controller.merge_patch(patch)
+        except ValueError:
+            return bytes([OP_ERROR, ERR_INVALID_STATE])
+        return self._state_message(OP_SET_OK, version, changed)
+
+    def _state_message(self, opcode: int, version: int, devices) -> bytes:
+        states = self.controller.device_states
+        records = b"".join(encode_state(self._index[dev], states[dev])
+                           for dev in devices if dev in self._index and dev in states)
+        return bytes([opcode]) + VERSION.pack(version) + records
+
+    def _on_change(self, version: int, changed: List[str]):
+        with self._subscribers_lock:
+            subscribers = list(self._subscribers)
+        if not subscribers:
+            return
+        event = self._state_message(OP_EVENT, version, changed)
+        # Called from inside mark_changed, so only queue here; never block on a socket
+        for handler in subscribers:
+            if not handler.push(event):
+                self.unsubscribe(handler)
+                handler.drop()
+
+
+class LocalApiClient:
+    """Minimal blocking client for automation scripts"""
+
+    def __init__(self, path: str = DEFAULT_SOCKET_PATH):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        reply = self._call(bytes([OP_MANIFEST]))
+        self.boot_id = f"{VERSION.unpack(reply[1:5])[0]:08x}"
+        self.manifest = self._parse_manifest(reply)
+        self._index = {name: i for i, name in enumerate(self.manifest)}
+
+    def get_state(self) -> Tuple[int, Dict[str, Tuple[int, int, int]]]:
+        return self._parse_states(self._call(bytes([OP_GET_STATE])))
+
+    def set(self, device: str, on: bool = False, direction: int = 0, value: int = 0):
+        record = RECORD.pack(self._index[device], int(on), direction, value)
+        return self._parse_states(self._call(bytes([OP_SET]) + record))
+
+    def state_token(self, version: int) -> str:
+        """Token for a version seen on this connection, to resume from with subscribe()"""
+        return f"{self.boot_id}-{version}"
+
+    def subscribe(self, since: Optional[str] = None):
+        """
+        Yield (version, changed records) forever, starting with changes since the
+        given state token (from state_token() or HTTP /status); without one, or
+        with one from before a controller restart, it starts with every device
+        """
+        boot_id, _, version = (since or "").rpartition("-")
+        try:
+            token = TOKEN.pack(int(boot_id, 16), int(version))
+        except (ValueError, struct.error):
+            token = TOKEN.pack(0, 0)
+        yield self._parse_states(self._call(bytes([OP_SUBSCRIBE]) + token))
+        while True:
+            yield self._parse_states(read_message(self.sock))
+
+    def close(self):
+        self.sock.close()
+
+    def _call(self, payload: bytes) -> bytes:
+        write_message(self.sock, payload)
+        reply = read_message(self.sock)
+        if reply[0] == OP_ERROR:
+            raise ValueError(f"local API error {reply[1]}")
+        return reply
+
+    def _parse_states(self, reply: bytes):
+        version = VERSION.unpack(reply[1:5])[0]
+        records = {self.manifest[i]: (on, direction, value)
+                   for i, on, direction, value in RECORD.iter_unpack(reply[5:])}
+        return version, records
+
+    @staticmethod
+    def _parse_manifest(reply: bytes) -> List[str]:
+        names, pos = [], 1 + VERSION.size
+        while pos < len(reply):
+            size = reply[pos]
+            names.append(reply[pos + 1:pos + 1 + size].decode())
+            pos += 1 + size
+        return names
+
+
+if __name__ == "__main__":
+    # Round-trip latency check against a running server
+    client = LocalApiClient(sys.argv[1] if len(sys.argv) > 1 else DEFAULT_SOCKET_PATH)
+    calls = 10000
+    start = time.perf_counter()
+    for _ in range(calls):
+        client.get_state()
+    elapsed = time.perf_counter() - start
+    print(f"GET_STATE: {elapsed / calls * 1e6:.1f} us per call over {calls} calls")
+    client.close()
@@ -0,0 +1,114 @@
+import contextlib
+import os
+import sys
+import threading
+from collections import Counter
+from typing import Dict, List, Optional
+
+_NOT_PROFILING = contextlib.nullcontext()
+
+
+class _Stage:
+    def __init__(self, profiler, name):
+        self.profiler = profiler
+        self.name = name
+
+    def __enter__(self):
+        self.profiler._push(self.name)
+
+    def __exit__(self, *exc):
+        self.profiler._pop()
+
+
+class SamplingProfiler:
+    """
+    Statistical profiler for the running server, off unless a run is in progress.
+
+    While a run is active a background thread snapshots the stack of every
+    thread that is inside a request or a tagged stage every interval seconds and
+    counts collapsed stacks ("stage;file:function;...") for flame graph tools.
+    Code marks its stages with `with PROFILER.stage("llm_wait"):`; when no run
+    is active that is a single attribute check returning a shared no-op context.
+    """
+
+    def __init__(self, interval: float = 0.005):
+        self.interval = interval
+        self.active = False
+        self._stages: Dict[int, List[str]] = {}
+        self._samples = Counter()
+        self._requests_left: Optional[int] = None
+        self._done = threading.Event()
+        self._run_lock = threading.Lock()
+
+    def stage(self, name: str):
+        if not self.active:
+            return _NOT_PROFILING
+        return _Stage(self, name)
+
+    def begin_request(self):
+        if self.active:
+            self._push("request")
+
+    def end_request(self):
+        if not self.active:
+            return
+        self._pop()
+        if self._requests_left is not None:
+            self._requests_left -= 1
+            if self._requests_left <= 0:
+                self._done.set()
+
+    def run(self, seconds: Optional[float] = None, requests: Optional[int] = None,
+            max_seconds: float = 60.0) -> str:
+        """
+        Sample for the given seconds, or until the given number of requests have
+        finished (capped at max_seconds), and return the collapsed stacks
+        """
+        if not self._run_lock.acquire(blocking=False):
+            raise RuntimeError("A profiling run is already in progress")
+        try:
+            self._samples = Counter()
+            self._stages = {}
+            self._requests_left = requests
+            self._done.clear()
+            self.active = True
+            sampler = threading.Thread(target=self._sample, daemon=True)
+            sampler.start()
+            self._done.wait(min(seconds or max_seconds, max_seconds))
+            self.active = False
+            self._done.set()
+            sampler.join()
+            return "\n".join(f"{stack} {count}" for stack, count in self._samples.most_common())
+        finally:
+            self._stages = {}
+            self._run_lock.release()
+
+    def _push(self, name):
+        self._stages.setdefault(threading.get_ident(), []).append(name)
+
+    def _pop(self):
+        stack = self._stages.get(threading.get_ident())
+        if stack:
+            stack.pop()
+
+    def _sample(self):
+        own_id = threading.get_ident()
+        while not self._done.wait(self.interval):
+            frames = sys._current_frames()
+            for thread_id, stages in list(self._stages.items()):
+                if thread_id == own_id or not stages or thread_id not in frames:
+                    continue
+                self._samples[self._collapse(stages[-1], frames[thread_id])] += 1
+
+    @staticmethod
+    def _collapse(stage, frame) -> str:
+        calls = []
+        while frame is not None:
+            code = frame.f_code
+            calls.append(f"{os.path.basename(code.co_filename)}:{code.co_name}")
+            frame = frame.f_back
+        return ";".join([stage] + calls[::-1])
+
+
+# One profiler per process, shared by every home
+PROFILER = SamplingProfiler()
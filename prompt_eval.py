@@ -0,0 +1,211 @@
+"""
+Offline comparison of the prompt templates in prompt_template.py.
+
+Every command in a labeled corpus is rendered through each template and answered
+from a recorded-response cache; cache misses go to a local keyword mock, or to
+Groq when --record is given (the answer is then saved so later runs are offline).
+Each answer is scored for parse success, whether the resulting device delta
+matches the label exactly, input/output tokens and latency, and a comparison
+table is printed.
+
+Corpus entries are {"command": ..., "expected": {device: state}}, where expected
+holds exactly the devices whose state differs from DEFAULT_DEVICE_STATES after
+the command.
+
+    python prompt_eval.py
+    python prompt_eval.py --record --groq-api-key <key> --templates template_5 template_7
+"""
+
+import argparse
+import copy
+import hashlib
+import json
+import os
+import re
+import statistics
+import time
+from typing import Any, Dict, List, Optional
+
+import prompt_template
+from app_version_7_intensity import DEFAULT_DEVICE_STATES, LLMContext, SmartHomeController
+
+CORPUS_PATH = "prompt_eval_corpus.json"
+CACHE_PATH = "prompt_eval_cache.json"
+MODEL_NAME = "llama-3.3-70b-versatile"
+
+
+def estimate_tokens(text: str) -> int:
+    """Rough token count for mock answers (about four characters per token)"""
+    return max(len(text) // 4, 1)
+
+
+class ResponseCache:
+    """Recorded answers keyed by a hash of model and fully rendered prompt"""
+
+    def __init__(self, path: str = CACHE_PATH):
+        self.path = path
+        self.entries: Dict[str, Dict[str, Any]] = {}
+        if os.path.exists(path):
+            with open(path, "r", encoding="utf-8") as f:
+                self.entries = json.load(f)
+
+    @staticmethod
+    def key(model: str, prompt: str) -> str:
+        return hashlib.sha256(f"{model}\n{prompt}".encode("utf-8")).hexdigest()
+
+    def get(self, model: str, prompt: str) -> Optional[Dict[str, Any]]:
+        return self.entries.get(self.key(model, prompt))
+
+    def put(self, model: str, prompt: str, entry: Dict[str, Any]):
+        self.entries[self.key(model, prompt)] = entry
+
+    def save(self):
+        tmp_path = f"{self.path}.tmp"
+        with open(tmp_path, "w", encoding="utf-8") as f:
+            json.dump(self.entries, f, indent=1)
+        os.replace(tmp_path, self.path)
+
+
+class GroqRecorder:
+    """Answers cache misses from Groq, keeping the token counts it reports"""
+
+    def __init__(self, groq_api_key: str, model: str = MODEL_NAME):
+        from groq import Groq
+        self.client = Groq(api_key=groq_api_key)
+        self.model = model
+
+    def answer(self, prompt: str) -> Dict[str, Any]:
+        started = time.perf_counter()
+        completion = self.client.chat.completions.create(
+            messages=[{"role": "user", "content": prompt}],
+            model=self.model
+        )
+        latency_ms = (time.perf_counter() - started) * 1000
+        return {
+            "text": completion.choices[0].message.content,
+            "latency_ms": latency_ms,
+            "prompt_tokens": completion.usage.prompt_tokens,
+            "completion_tokens": completion.usage.completion_tokens
+        }
+
+
+class KeywordMock:
+    """
+    Deterministic stand-in that reads device names, on/off and percentages from
+    the command itself; it only exercises the scoring path, it does not judge
+    the template text
+    """
+
+    def answer(self, prompt: str, command: str) -> Dict[str, Any]:
+        started = time.perf_counter()
+        text = command.lower()
+        switch = "off" if re.search(r"\b(off|stop|disable)\b", text) else "on"
+        states, intensity = {}, {}
+        for device in DEFAULT_DEVICE_STATES:
+            if device.lower() in text:
+                states[device] = switch
+        percent = re.search(r"(\d+)\s*%", text)
+        if percent:
+            for light in ("room 2 light", "room 3 light"):
+                if light in states:
+                    intensity[light] = int(percent.group(1))
+        answer = json.dumps({
+            "device_states": states,
+            "light_intensity": intensity,
+            "chatbot_message": "Done",
+            "delay_seconds": 0,
+            "confidence": 1.0
+        })
+        return {
+            "text": f"```json\n{answer}\n```",
+            "latency_ms": (time.perf_counter() - started) * 1000,
+            "prompt_tokens": estimate_tokens(prompt),
+            "completion_tokens": estimate_tokens(answer)
+        }
+
+
+def device_delta(parsed_output: Dict[str, Any]) -> Dict[str, Any]:
+    """Devices that differ from the reset state after applying one answer"""
+    states = copy.deepcopy(DEFAULT_DEVICE_STATES)
+    SmartHomeController.apply_parsed_output(states, parsed_output)
+    return {dev: state for dev, state in states.items() if state != DEFAULT_DEVICE_STATES[dev]}
+
+
+def evaluate_template(name: str, corpus: List[Dict[str, Any]], cache: ResponseCache,
+                      recorder: Optional[GroqRecorder], mock: KeywordMock) -> Dict[str, Any]:
+    context = LLMContext(template=getattr(prompt_template, name), cascade_models=())
+    parsed_ok = correct = 0
+    prompt_tokens, completion_tokens, latencies = [], [], []
+    for case in corpus:
+        prompt = context.prompt.format(command=case["command"])
+        entry = cache.get(MODEL_NAME, prompt)
+        if entry is None and recorder is not None:
+            entry = recorder.answer(prompt)
+            cache.put(MODEL_NAME, prompt, entry)
+        if entry is None:
+            entry = mock.answer(prompt, case["command"])
+
+        prompt_tokens.append(entry["prompt_tokens"])
+        completion_tokens.append(entry["completion_tokens"])
+        latencies.append(entry["latency_ms"])
+        try:
+            parsed_output = context.output_parser.parse(entry["text"])
+        except Exception:
+            continue
+        parsed_ok += 1
+        if device_delta(parsed_output) == case["expected"]:
+            correct += 1
+
+    cases = len(corpus)
+    latencies.sort()
+    return {
+        "template": name,
+        "parse_rate": parsed_ok / cases,
+        "delta_accuracy": correct / cases,
+        "prompt_tokens": statistics.mean(prompt_tokens),
+        "completion_tokens": statistics.mean(completion_tokens),
+        "mean_latency_ms": statistics.mean(latencies),
+        "p95_latency_ms": latencies[min(int(cases * 0.95), cases - 1)]
+    }
+
+
+def print_table(results: List[Dict[str, Any]]):
+    header = f"{'template':<12}{'parse':>8}{'delta':>8}{'in tok':>9}{'out tok':>9}{'mean ms':>10}{'p95 ms':>10}"
+    print(header)
+    print("-" * len(header))
+    for r in results:
+        print(f"{r['template']:<12}{r['parse_rate']:>8.0%}{r['delta_accuracy']:>8.0%}"
+              f"{r['prompt_tokens']:>9.0f}{r['completion_tokens']:>9.0f}"
+              f"{r['mean_latency_ms']:>10.1f}{r['p95_latency_ms']:>10.1f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare prompt templates on a labeled command corpus")
+    parser.add_argument("--corpus", default=CORPUS_PATH)
+    parser.add_argument("--cache", default=CACHE_PATH)
+    parser.add_argument("--templates", nargs="*",
+                        help="Template names to compare (default: every template_N in prompt_template.py)")
+    parser.add_argument("--record", action="store_true", help="Call Groq for cache misses and save the answers")
+    parser.add_argument("--groq-api-key", default=os.environ.get("GROQ_API_KEY"))
+    parser.add_argument("--json", action="store_true", help="Print results as JSON instead of a table")
+    args = parser.parse_args()
+
+    with open(args.corpus, "r", encoding="utf-8") as f:
+        corpus = json.load(f)
+    names = args.templates or sorted(n for n in dir(prompt_template) if re.fullmatch(r"template_\d+", n))
+    cache = ResponseCache(args.cache)
+    recorder = GroqRecorder(args.groq_api_key) if args.record else None
+    mock = KeywordMock()
+
+    results = [evaluate_template(name, corpus, cache, recorder, mock) for name in names]
+    if recorder is not None:
+        cache.save()
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+    else:
+        print_table(results)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,103 @@
+import copy
+import json
+import logging
+import os
+import threading
+from collections import OrderedDict
+from typing import Any, Dict, Tuple
+
+
+class SerialOutbox:
+    """
+    Durable store-and-forward queue for device updates bound for the microcontroller.
+
+    Updates are coalesced per device (only the newest state of each device is kept),
+    persisted to disk on every change and handed out in one batch when the serial
+    link is available. The backlog is capped at max_pending devices; when the cap is
+    hit the oldest entries are dropped and a full resync is requested instead.
+    """
+
+    def __init__(self, path: str = "serial_outbox.json", max_pending: int = 64):
+        self.path = path
+        self.max_pending = max_pending
+        self.dropped = 0
+        self.resync_required = False
+        self._pending: "OrderedDict[str, Any]" = OrderedDict()
+        self._lock = threading.Lock()
+        self._load()
+
+    def __len__(self) -> int:
+        return len(self._pending)
+
+    def has_work(self) -> bool:
+        return bool(self._pending) or self.resync_required
+
+    def snapshot(self) -> Dict[str, Any]:
+        """Copy of the pending updates, oldest first"""
+        with self._lock:
+            return copy.deepcopy(dict(self._pending))
+
+    def put(self, updates: Dict[str, Any]):
+        """Queue updates, replacing any older pending state of the same device"""
+        if not updates:
+            return
+        with self._lock:
+            for device, state in updates.items():
+                self._pending.pop(device, None)
+                self._pending[device] = copy.deepcopy(state)
+            while len(self._pending) > self.max_pending:
+                self._pending.popitem(last=False)
+                self.dropped += 1
+                self.resync_required = True
+            self._save()
+
+    def take(self) -> Tuple[Dict[str, Any], bool]:
+        """Remove and return every pending update together with the resync flag"""
+        with self._lock:
+            pending, self._pending = self._pending, OrderedDict()
+            resync, self.resync_required = self.resync_required, False
+            self._save()
+        return pending, resync
+
+    def request_resync(self):
+        """Have the next take() ask for the full state, e.g. after the board reset"""
+        with self._lock:
+            self.resync_required = True
+            self._save()
+
+    def restore(self, pending: Dict[str, Any], resync: bool):
+        """Put back updates that could not be delivered without overriding newer ones"""
+        with self._lock:
+            merged = OrderedDict(pending)
+            for device, state in self._pending.items():
+                merged.pop(device, None)
+                merged[device] = state
+            self._pending = merged
+            self.resync_required = self.resync_required or resync
+            while len(self._pending) > self.max_pending:
+                self._pending.popitem(last=False)
+                self.dropped += 1
+                self.resync_required = True
+            self._save()
+
+    def _load(self):
+        if not self.path or not os.path.exists(self.path):
+            return
+        try:
+            with open(self.path, "r", encoding="utf-8") as f:
+                data = json.load(f)
+            self._pending = OrderedDict(data.get("pending", {}))
+            self.resync_required = bool(data.get("resync", False))
+        except (OSError, ValueError) as e:
+            logging.error(f"Discarding unreadable outbox file {self.path}: {e}")
+
+    def _save(self):
+        if not self.path:
+            return
+        tmp_path = self.path + ".tmp"
+        try:
+            with open(tmp_path, "w", encoding="utf-8") as f:
+                json.dump({"pending": self._pending, "resync": self.resync_required}, f)
+            os.replace(tmp_path, self.path)
+        except OSError as e:
+            logging.error(f"Error persisting outbox: {e}")
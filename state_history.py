@@ -0,0 +1,261 @@
+import os
+import re
+import struct
+import threading
+import time
+from array import array
+from typing import Any, Dict, List, Optional
+
+from local_api import DIRECTIONS
+
+# Spill files are a sequence of blocks: header (first timestamp in ms, sample count)
+# followed by that many samples of (delta ms from the previous sample, on,
+# direction, value), little endian
+BLOCK_HEADER = struct.Struct("<qI")
+SAMPLE = struct.Struct("<IBBh")
+
+
+def encode_sample(state: Any):
+    """(on, direction, value) for a state in the controller's dict/str form"""
+    if isinstance(state, dict):
+        if "direction" in state:
+            direction = state.get("direction", "none")
+            return 0, DIRECTIONS.index(direction) if direction in DIRECTIONS else 0, int(state.get("degrees", 0))
+        on = state.get("state") == "on"
+        return int(on), 0, int(state.get("intensity", 0)) if on else 0
+    on = state == "on"
+    return int(on), 0, 100 if on else 0
+
+
+class _DeviceColumns:
+    """
+    One device's recent history as parallel arrays: delta-encoded timestamps
+    (u32 ms, the first relative to base_ms) and on/direction/value columns.
+    8 bytes per sample.
+    """
+
+    def __init__(self):
+        self.base_ms = 0
+        self.last_ms = 0
+        self.deltas = array("I")
+        self.on = array("B")
+        self.direction = array("B")
+        self.value = array("h")
+
+    def __len__(self):
+        return len(self.deltas)
+
+    def append(self, at_ms: int, on: int, direction: int, value: int):
+        if not self.deltas:
+            self.base_ms = at_ms
+            self.deltas.append(0)
+        else:
+            # Clock steps backwards are clamped rather than stored as huge deltas
+            self.deltas.append(min(max(at_ms - self.last_ms, 0), 0xFFFFFFFF))
+        self.last_ms = max(at_ms, self.last_ms)
+        self.on.append(on)
+        self.direction.append(direction)
+        self.value.append(value)
+
+    def samples(self):
+        at = self.base_ms
+        for i in range(len(self.deltas)):
+            at += self.deltas[i] if i else 0
+            yield at, self.on[i], self.direction[i], self.value[i]
+
+    def pop_front(self, count: int) -> bytes:
+        """Remove the oldest count samples and return them as one spill block"""
+        block = bytearray(BLOCK_HEADER.pack(self.base_ms, count))
+        at = self.base_ms
+        for i in range(count):
+            delta = self.deltas[i] if i else 0
+            at += delta
+            block += SAMPLE.pack(delta, self.on[i], self.direction[i], self.value[i])
+        if count < len(self.deltas):
+            at += self.deltas[count]
+        for column in (self.deltas, self.on, self.direction, self.value):
+            del column[:count]
+        if self.deltas:
+            self.base_ms = at
+            self.deltas[0] = 0
+        return bytes(block)
+
+
+class StateHistory:
+    """
+    Per-device state history without an external database.
+
+    Every state change is appended to the device's in-memory columns; when a
+    device reaches ring_size samples the oldest half is spilled to
+    <directory>/<device>.bin. Memory therefore stays at most
+    ring_size * 8 bytes per device (32 KiB at the default 4096) however many
+    changes a day brings; a device switched every minute of a day spills about
+    11.5 KiB of disk per day. Spilled blocks older than retention_days are
+    dropped from the file after each spill (None keeps everything).
+
+    Queries read only the spill blocks that overlap their range, found from
+    the block headers, and read them without holding the lock record() takes.
+    """
+
+    def __init__(self, directory: str = "state_history", ring_size: int = 4096,
+                 retention_days: Optional[float] = 90):
+        self.directory = directory
+        self.ring_size = ring_size
+        self.retention_days = retention_days
+        self._columns: Dict[str, _DeviceColumns] = {}
+        self._lock = threading.Lock()
+        # Held while a spill file is read or rewritten; always taken before _lock
+        self._file_lock = threading.Lock()
+        os.makedirs(directory, exist_ok=True)
+
+    def record(self, states: Dict[str, Any], at: Optional[float] = None):
+        """Append the given device states, stamped at (default now) epoch seconds"""
+        at_ms = int((at if at is not None else time.time()) * 1000)
+        spilled = []
+        with self._lock:
+            for device, state in states.items():
+                columns = self._columns.setdefault(device, _DeviceColumns())
+                columns.append(at_ms, *encode_sample(state))
+                if len(columns) >= self.ring_size:
+                    self._spill(device, columns.pop_front(self.ring_size // 2))
+                    spilled.append(device)
+        for device in spilled:
+            self._expire(device)
+
+    def flush(self):
+        """Spill everything in memory, e.g. before shutdown"""
+        with self._lock:
+            for device, columns in self._columns.items():
+                if len(columns):
+                    self._spill(device, columns.pop_front(len(columns)))
+
+    def memory_bytes(self) -> int:
+        return sum(len(c) * SAMPLE.size for c in self._columns.values())
+
+    def query(self, device: str, start: float, end: float, buckets: int = 24) -> Dict[str, Any]:
+        """
+        Downsample [start, end) (epoch seconds) into equal buckets, each with the
+        time the device was on, its time-weighted mean value while on and the
+        number of changes
+        """
+        start_ms, end_ms = int(start * 1000), int(end * 1000)
+        width = max((end_ms - start_ms) / buckets, 1)
+        series = [{"start": (start_ms + i * width) / 1000, "on_s": 0.0, "mean_value": None, "changes": 0}
+                  for i in range(buckets)]
+        weighted = [0.0] * buckets
+
+        # Each sample holds until the next one; the last holds until now
+        previous = None
+        for sample in self._samples(device, start_ms, end_ms) + [(int(time.time() * 1000), None, None, None)]:
+            if previous is not None:
+                self._accumulate(series, weighted, previous, sample[0], start_ms, end_ms, width)
+            if sample[1] is not None and start_ms <= sample[0] < end_ms:
+                series[min(int((sample[0] - start_ms) // width), buckets - 1)]["changes"] += 1
+            previous = sample
+
+        for bucket, total in zip(series, weighted):
+            if bucket["on_s"]:
+                bucket["mean_value"] = round(total / bucket["on_s"], 1)
+            bucket["on_s"] = round(bucket["on_s"], 1)
+        return {
+            "device": device,
+            "start": start,
+            "end": end,
+            "on_s": round(sum(b["on_s"] for b in series), 1),
+            "buckets": series
+        }
+
+    @staticmethod
+    def _accumulate(series, weighted, sample, until_ms, start_ms, end_ms, width):
+        at_ms, on, _, value = sample
+        if not on:
+            return
+        span_start, span_end = max(at_ms, start_ms), min(until_ms, end_ms)
+        while span_start < span_end:
+            index = min(int((span_start - start_ms) // width), len(series) - 1)
+            bucket_end = min(start_ms + (index + 1) * width, span_end)
+            seconds = (bucket_end - span_start) / 1000
+            series[index]["on_s"] += seconds
+            weighted[index] += seconds * value
+            span_start = bucket_end if bucket_end > span_start else span_end
+
+    def _samples(self, device: str, start_ms: int, end_ms: int) -> List[tuple]:
+        """The sample in force at start_ms followed by every sample in [start_ms, end_ms)"""
+        path = self._path(device)
+        with self._file_lock:
+            # Spills only append, so the file up to this size is stable while
+            # it is read; _lock is held just long enough to pair it with memory
+            with self._lock:
+                columns = self._columns.get(device)
+                recent = list(columns.samples()) if columns is not None else []
+                size = os.path.getsize(path) if os.path.exists(path) else 0
+            samples = self._read_spilled(path, size, start_ms, end_ms) + recent
+
+        before = [s for s in samples if s[0] < start_ms]
+        return before[-1:] + [s for s in samples if start_ms <= s[0] < end_ms]
+
+    def _read_spilled(self, path: str, size: int, start_ms: int, end_ms: int) -> List[tuple]:
+        """Decode the blocks in the first size bytes of path that can matter for [start_ms, end_ms)"""
+        if not size:
+            return []
+        samples = []
+        with open(path, "rb") as f:
+            blocks = [b for b in self._blocks(f, size) if b[1] < end_ms]
+            # The last block starting at or before start_ms holds the state in force at start_ms
+            first = max([i for i, b in enumerate(blocks) if b[1] <= start_ms], default=0)
+            for offset, at, count in blocks[first:]:
+                f.seek(offset + BLOCK_HEADER.size)
+                for delta, on, direction, value in SAMPLE.iter_unpack(f.read(count * SAMPLE.size)):
+                    at += delta
+                    samples.append((at, on, direction, value))
+        return samples
+
+    @staticmethod
+    def _blocks(f, size: int):
+        """(offset, first ms, sample count) of each complete block, reading only the headers"""
+        offset = 0
+        while offset + BLOCK_HEADER.size <= size:
+            f.seek(offset)
+            first_ms, count = BLOCK_HEADER.unpack(f.read(BLOCK_HEADER.size))
+            end = offset + BLOCK_HEADER.size + count * SAMPLE.size
+            if end > size:
+                return  # Cut short by a crash mid-spill
+            yield offset, first_ms, count
+            offset = end
+
+    def _expire(self, device: str):
+        """Drop spill blocks that ended before the retention window"""
+        if not self.retention_days:
+            return
+        cutoff_ms = int((time.time() - self.retention_days * 86400) * 1000)
+        path = self._path(device)
+        with self._file_lock, self._lock:
+            try:
+                with open(path, "rb") as f:
+                    size = os.fstat(f.fileno()).st_size
+                    # Keep from the last block starting by the cutoff: every block
+                    # before it ended when it started
+                    keep = 0
+                    for offset, first_ms, _ in self._blocks(f, size):
+                        if first_ms > cutoff_ms:
+                            break
+                        keep = offset
+                    if not keep:
+                        return
+                    f.seek(keep)
+                    data = f.read()
+                with open(path + ".tmp", "wb") as f:
+                    f.write(data)
+                os.replace(path + ".tmp", path)
+            except OSError as e:
+                print(f"Error expiring state history for {device}: {e}")
+
+    def _spill(self, device: str, block: bytes):
+        try:
+            with open(self._path(device), "ab") as f:
+                f.write(block)
+        except OSError as e:
+            print(f"Error spilling state history for {device}: {e}")
+
+    def _path(self, device: str) -> str:
+        return os.path.join(self.directory, re.sub(r"[^A-Za-z0-9]+", "_", device).strip("_") + ".bin")
@@ -0,0 +1,139 @@
+import logging
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+from typing import Any, Dict, Optional
+
+from fast_path import FastPathParser, command_key
+
+
+class _Session:
+    def __init__(self, controller):
+        self.controller = controller
+        self.text = ""
+        self.key = ""
+        self.generation = 0      # Bumped whenever the meaning (command_key) changes
+        self.fast = None         # Fast path answer for the current text
+        self.speculation = None  # Future of the LLM answer for speculated_key
+        self.speculated_key = None
+        self.updated = time.monotonic()
+
+
+class TranscriptStreams:
+    """
+    Partial speech transcripts, so intent parsing overlaps with the user still talking.
+
+    Every update runs the fast path parser on the text so far. If it cannot
+    handle the text and the text's meaning (its command_key) then holds for
+    stable_seconds, the LLM call starts speculatively on a worker thread. A
+    later update that changes the meaning discards that answer (an HTTP call
+    already in flight cannot be aborted; it finishes and is ignored). Nothing is
+    applied until commit: the final text is then answered from the fast path,
+    else from a speculation made for exactly that text, else by a fresh LLM call.
+    """
+
+    def __init__(self, scheduler, stable_seconds: float = 0.3, session_timeout: float = 30.0,
+                 max_workers: int = 4):
+        self.scheduler = scheduler
+        self.stable_seconds = stable_seconds
+        self.session_timeout = session_timeout
+        self._executor = ThreadPoolExecutor(max_workers=max_workers, thread_name_prefix="speculative-llm")
+        self._sessions: Dict[tuple, _Session] = {}
+        self._lock = threading.Lock()
+        self.metrics = {
+            "updates": 0,
+            "speculations": 0,
+            "speculations_discarded": 0,
+            "committed_fast": 0,
+            "committed_speculative": 0,
+            "committed_llm": 0
+        }
+
+    def update(self, home_id, session_id: str, controller, text: Optional[str] = None,
+               chunk: Optional[str] = None) -> Dict[str, Any]:
+        """
+        Replace the session's transcript with text (a recognizer's latest
+        hypothesis) or append chunk (whole words) to it
+        """
+        with self._lock:
+            self._expire()
+            session = self._sessions.get((home_id, session_id))
+            if session is None or session.controller is not controller:
+                session = self._sessions[(home_id, session_id)] = _Session(controller)
+            if text is not None:
+                session.text = text.strip()
+            elif chunk:
+                session.text = f"{session.text} {chunk.strip()}".strip()
+            session.updated = time.monotonic()
+            self.metrics["updates"] += 1
+
+            key = command_key(session.text)
+            if key != session.key:
+                session.key = key
+                session.generation += 1
+                if session.speculation is not None:
+                    session.speculation.cancel()
+                    session.speculation = None
+                    self.metrics["speculations_discarded"] += 1
+                session.fast = self._fast_parse(controller, session.text) if key else None
+                if key and session.fast is None:
+                    self.scheduler.schedule(self.stable_seconds, self._speculate,
+                                            (home_id, session_id), session.generation)
+            return {
+                "text": session.text,
+                "fast_path": session.fast is not None,
+                "speculating": session.speculation is not None
+            }
+
+    def commit(self, home_id, session_id: str, controller, text: Optional[str] = None,
+               chunk: Optional[str] = None) -> Optional[Dict[str, Any]]:
+        """
+        Finish the utterance and apply it; returns the controller's command
+        result plus the path that answered it, or None if it failed
+        """
+        self.update(home_id, session_id, controller, text, chunk)
+        with self._lock:
+            session = self._sessions.pop((home_id, session_id))
+        if not session.key:
+            return None
+
+        parsed_output, path = session.fast, "fast"
+        try:
+            if parsed_output is None and session.speculation is not None and session.speculated_key == session.key:
+                try:
+                    parsed_output, path = session.speculation.result(), "speculative"
+                except Exception as e:
+                    logging.error(f"Speculative command parsing failed, retrying: {e}")
+            if parsed_output is None:
+                parsed_output, path = controller.interpret(session.text), "llm"
+            result = controller.apply_command_output(parsed_output)
+        except Exception as e:
+            logging.error(f"Command parsing error: {e}")
+            return None
+        self.metrics[f"committed_{path}"] += 1
+        result["path"] = path
+        return result
+
+    def _speculate(self, session_key: tuple, generation: int):
+        with self._lock:
+            session = self._sessions.get(session_key)
+            # The text changed meaning (or the session ended) since this was scheduled
+            if session is None or session.generation != generation or session.speculation is not None:
+                return
+            session.speculated_key = session.key
+            session.speculation = self._executor.submit(session.controller.interpret, session.text)
+            self.metrics["speculations"] += 1
+
+    def _expire(self):
+        now = time.monotonic()
+        for session_key, session in list(self._sessions.items()):
+            if now - session.updated > self.session_timeout:
+                if session.speculation is not None:
+                    session.speculation.cancel()
+                del self._sessions[session_key]
+
+    @staticmethod
+    def _fast_parse(controller, text: str) -> Optional[Dict[str, Any]]:
+        # Built per call: the controller's groups and resolver change when the device table does
+        return FastPathParser(controller.device_states, controller.device_groups,
+                              controller.name_resolver).parse(text)
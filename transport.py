@@ -0,0 +1,146 @@
+"""
+Links to a board. Everything that talks to the board uses this subset of the
+pyserial Serial API, so any object providing it can carry the protocol:
+
+    write(data) -> int
+    readline() -> bytes       waits at most .timeout seconds; a partial line on timeout
+    reset_input_buffer()
+    in_waiting                bytes ready to read
+    timeout                   seconds, settable
+    baudrate                  settable unless supports_baud_change is False
+    close()
+
+Local ports and RFC 2217 bridges are pyserial objects (its RFC 2217 client
+already disables Nagle); raw TCP bridges such as ser2net in raw mode or
+"socat TCP-LISTEN:7000,nodelay /dev/ttyUSB0,raw,b9600" use TcpTransport.
+
+    open_transport("COM5")
+    open_transport("tcp://bridge.local:7000")
+    open_transport("rfc2217://bridge.local:7001")
+"""
+
+import select
+import socket
+import time
+from urllib.parse import urlsplit
+
+import serial
+
+
+def is_local_port(url: str) -> bool:
+    """True for a port on this machine (opening it resets the board), False for a bridge URL"""
+    return "://" not in url
+
+
+def open_transport(url: str, baudrate: int = 9600, timeout: float = 1.0):
+    """Open the link named by url: a local port name, tcp://host:port or rfc2217://host:port"""
+    if url.startswith(("tcp://", "socket://")):
+        parsed = urlsplit(url)
+        if not parsed.hostname or not parsed.port:
+            raise serial.SerialException(f"Expected tcp://host:port, got {url}")
+        return TcpTransport(parsed.hostname, parsed.port, baudrate=baudrate, timeout=timeout)
+    if not is_local_port(url):
+        # rfc2217:// and pyserial's other URL handlers (loop://, spy://...)
+        return serial.serial_for_url(url, baudrate=baudrate, timeout=timeout)
+    return serial.Serial(
+        port=url,
+        baudrate=baudrate,
+        bytesize=serial.EIGHTBITS,
+        parity=serial.PARITY_NONE,
+        stopbits=serial.STOPBITS_ONE,
+        timeout=timeout
+    )
+
+
+class TcpTransport:
+    """
+    Raw byte stream to a serial bridge over TCP.
+
+    The socket is non-blocking with Nagle disabled, so a frame leaves in one
+    segment as soon as it is written; reads wait in select() for at most the
+    timeout and buffer what arrives, handing it out a line at a time. The
+    bridge owns the board's port and its baud rate, so the rate cannot be
+    changed from here.
+    """
+
+    supports_baud_change = False
+
+    def __init__(self, host: str, port: int, baudrate: int = 9600, timeout: float = 1.0,
+                 connect_timeout: float = 3.0):
+        try:
+            self._sock = socket.create_connection((host, port), timeout=connect_timeout)
+        except OSError as e:
+            raise serial.SerialException(f"Could not connect to bridge {host}:{port}: {e}") from e
+        self._sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self._sock.setblocking(False)
+        self._buffer = bytearray()
+        self._baudrate = baudrate
+        self.timeout = timeout
+        self.port = f"tcp://{host}:{port}"
+
+    @property
+    def baudrate(self) -> int:
+        return self._baudrate
+
+    @baudrate.setter
+    def baudrate(self, value: int):
+        if value != self._baudrate:
+            raise serial.SerialException("A raw TCP bridge runs the board at a fixed baud rate")
+
+    @property
+    def in_waiting(self) -> int:
+        self._receive(0)
+        return len(self._buffer)
+
+    def write(self, data: bytes) -> int:
+        view = memoryview(data)
+        deadline = time.monotonic() + (self.timeout if self.timeout is not None else 1.0)
+        while view:
+            try:
+                view = view[self._sock.send(view):]
+            except BlockingIOError:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0 or not select.select([], [self._sock], [], remaining)[1]:
+                    raise serial.SerialTimeoutException("Write to bridge timed out")
+            except OSError as e:
+                raise serial.SerialException(f"Bridge connection failed: {e}") from e
+        return len(data)
+
+    def readline(self) -> bytes:
+        deadline = None if self.timeout is None else time.monotonic() + self.timeout
+        while True:
+            end = self._buffer.find(b"\n")
+            if end >= 0:
+                line = bytes(self._buffer[:end + 1])
+                del self._buffer[:end + 1]
+                return line
+            remaining = None if deadline is None else deadline - time.monotonic()
+            if remaining is not None and remaining <= 0:
+                line = bytes(self._buffer)
+                self._buffer.clear()
+                return line
+            self._receive(remaining)
+
+    def reset_input_buffer(self):
+        while True:
+            self._buffer.clear()
+            self._receive(0)
+            if not self._buffer:
+                return
+
+    def close(self):
+        self._sock.close()
+
+    def _receive(self, timeout):
+        """Append whatever has arrived, waiting up to timeout seconds (None: forever) for it"""
+        if not select.select([self._sock], [], [], timeout)[0]:
+            return
+        try:
+            data = self._sock.recv(4096)
+        except BlockingIOError:
+            return
+        except OSError as e:
+            raise serial.SerialException(f"Bridge connection failed: {e}") from e
+        if not data:
+            raise serial.SerialException("Bridge closed the connection")
+        self._buffer += data
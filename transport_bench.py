@@ -0,0 +1,186 @@
+"""
+Round-trip latency of a frame over each transport in transport.py, measured
+against local stand-ins so no board or network is needed (POSIX only):
+
+  serial   the host opens one end of a pty; a fake board answers on the other
+  tcp      a bridge thread holds the pty and relays raw bytes over loopback TCP
+  rfc2217  the same bridge speaking RFC 2217 through pyserial's PortManager
+
+The fake board answers CMD_OK to every START...END frame, like the firmware
+does for "ping,0", so the numbers are pure link overhead. --url measures an
+existing endpoint instead: a real board, or a socat bridge in front of one.
+
+    python transport_bench.py --frames 500
+    python transport_bench.py --url tcp://bridge.local:7000
+"""
+
+import argparse
+import json
+import os
+import select
+import socket
+import statistics
+import threading
+import time
+import tty
+from typing import Any, Dict, List
+
+import serial
+import serial.rfc2217
+
+from transport import open_transport
+
+FRAME = b"STARTping,0END\n"
+
+
+class FakeBoard:
+    """Answers CMD_OK to each frame written to the other end of a pty"""
+
+    def __init__(self):
+        self.master, self._slave = os.openpty()
+        tty.setraw(self._slave)
+        self.port = os.ttyname(self._slave)
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def _run(self):
+        pending = b""
+        while True:
+            try:
+                pending += os.read(self.master, 4096)
+            except OSError:
+                return
+            while b"END" in pending:
+                _, pending = pending.split(b"END", 1)
+                os.write(self.master, b"CMD_OK\r\n")
+
+
+class _PtySerial(serial.Serial):
+    """A pty has no modem control lines; report them idle instead of failing the ioctl"""
+
+    cts = dsr = ri = cd = False
+
+    def _update_dtr_state(self):
+        pass
+
+    def _update_rts_state(self):
+        pass
+
+
+class _SocketWriter:
+    """The connection object PortManager expects"""
+
+    def __init__(self, sock):
+        self.sock = sock
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+
+class Bridge:
+    """Serves one TCP client at a time from a fake board's pty, raw or with RFC 2217 negotiation"""
+
+    def __init__(self, port: str, rfc2217: bool = False):
+        self.serial = _PtySerial(port, 9600, timeout=0)
+        self.rfc2217 = rfc2217
+        self.listener = socket.create_server(("127.0.0.1", 0))
+        scheme = "rfc2217" if rfc2217 else "tcp"
+        self.url = f"{scheme}://127.0.0.1:{self.listener.getsockname()[1]}"
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def _run(self):
+        while True:
+            conn, _ = self.listener.accept()
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            manager = serial.rfc2217.PortManager(self.serial, _SocketWriter(conn)) if self.rfc2217 else None
+            try:
+                self._relay(conn, manager)
+            except OSError:
+                pass
+            conn.close()
+
+    def _relay(self, conn, manager):
+        while True:
+            readable = select.select([conn, self.serial.fileno()], [], [])[0]
+            if conn in readable:
+                data = conn.recv(4096)
+                if not data:
+                    return
+                if manager is not None:
+                    data = b"".join(manager.filter(data))
+                self.serial.write(data)
+            if self.serial.fileno() in readable:
+                data = self.serial.read(self.serial.in_waiting or 1)
+                if manager is not None:
+                    data = b"".join(manager.escape(data))
+                conn.sendall(data)
+
+
+def round_trips(url: str, frames: int, warmup: int = 20) -> List[float]:
+    """Seconds from writing each frame to reading its CMD_OK"""
+    link = open_transport(url, timeout=2.0)
+    samples = []
+    try:
+        for i in range(warmup + frames):
+            started = time.perf_counter()
+            link.write(FRAME)
+            while True:
+                line = link.readline()
+                if not line:
+                    raise TimeoutError(f"No CMD_OK from {url}")
+                if line.strip() == b"CMD_OK":
+                    break
+            if i >= warmup:
+                samples.append(time.perf_counter() - started)
+    finally:
+        link.close()
+    return samples
+
+
+def summarize(name: str, samples: List[float]) -> Dict[str, Any]:
+    samples = sorted(samples)
+    percentile = lambda p: samples[min(int(len(samples) * p), len(samples) - 1)] * 1e6
+    return {
+        "transport": name,
+        "mean_us": statistics.mean(samples) * 1e6,
+        "p50_us": percentile(0.5),
+        "p95_us": percentile(0.95),
+        "p99_us": percentile(0.99)
+    }
+
+
+def print_table(results: List[Dict[str, Any]]):
+    baseline = results[0]["mean_us"]
+    header = f"{'transport':<12}{'mean us':>10}{'p50 us':>10}{'p95 us':>10}{'p99 us':>10}{'overhead':>10}"
+    print(header)
+    print("-" * len(header))
+    for r in results:
+        print(f"{r['transport']:<12}{r['mean_us']:>10.0f}{r['p50_us']:>10.0f}{r['p95_us']:>10.0f}"
+              f"{r['p99_us']:>10.0f}{r['mean_us'] - baseline:>+10.0f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark frame round trips per transport")
+    parser.add_argument("--frames", type=int, default=200)
+    parser.add_argument("--url", help="Measure this port or bridge URL instead of the local stand-ins")
+    parser.add_argument("--json", action="store_true", help="Print results as JSON instead of a table")
+    args = parser.parse_args()
+
+    if args.url:
+        targets = [(args.url, args.url)]
+    else:
+        # One board per stand-in: every open handle on a pty competes for its replies
+        targets = [
+            ("serial", FakeBoard().port),
+            ("tcp", Bridge(FakeBoard().port).url),
+            ("rfc2217", Bridge(FakeBoard().port, rfc2217=True).url)
+        ]
+
+    results = [summarize(name, round_trips(url, args.frames)) for name, url in targets]
+    if args.json:
+        print(json.dumps(results, indent=2))
+    else:
+        print_table(results)
+
+
+if __name__ == "__main__":
+    main()